@@ -1,8 +1,32 @@
 #include "CImg.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "lib/krabs.h"
+#include "lib/krabs_capture.h"
+#include "lib/krabs_contour.h"
+#include "lib/krabs_convert.h"
+#include "lib/krabs_events.h"
+#include "lib/krabs_flow.h"
+#include "lib/krabs_heatmap.h"
+#include "lib/krabs_mask.h"
+#include "lib/krabs_motion.h"
+#include "lib/krabs_pacer.h"
+#include "lib/krabs_pipeline.h"
+#include "lib/krabs_recorder.h"
+#include "lib/krabs_regions.h"
+#include "lib/krabs_source.h"
+#include "lib/krabs_tracker.h"
 
 using namespace std;
 using namespace cimg_library;
@@ -11,6 +35,23 @@ const double kGreen[] = {0,255,0};
 const double kRed[] = {255,0,0};
 const int kMaxImageWidth = 300;
 const int kResolution[] = {640,480}; // width, height
+const float kMixtureLearningRate = 0.01f;
+const double kTrackIoU = 0.3;
+const unsigned int kTrackMisses = 5;
+const int kVectorBlock = 8;  // motion vector block side and search range, at analysis scale
+const int kVectorRange = 16;
+const int kArrowScale = 4;   // motion vectors are drawn this many times longer
+const double kWindowFps = 10;  // default motion detection rate of a live camera shown in a window
+
+// set on SIGINT or SIGTERM, or when a camera fails: every motion detection loop ends at its next frame and saves what it keeps
+static atomic<bool> stop_requested(false);
+
+//! Asks motion detection to stop, a second signal kills the process
+void RequestStop(int signal_number)
+{
+	stop_requested = true;
+	signal(signal_number, SIG_DFL);
+}
 
 void DrawRect(const KrabsRegion& region, CImg<double>& image)
 {
@@ -23,27 +64,59 @@ void DrawRect(const KrabsRegion& region, CImg<double>& image)
 	image.draw_line(region.x0, region.y1, region.x1, region.y0, kRed, 1);
 }
 
-void EdgeDetection(const char* filename, const double low_threshold, const double high_threshold, const float sigma)
+//! Opens the first source of a comma separated list, see KrabsOpenFrameSource
+unique_ptr<KrabsFrameSource> OpenFirstSource(const char* sources, string& name)
+{
+	const string kSources(sources);
+	name = kSources.substr(0, kSources.find(','));
+
+	return KrabsOpenFrameSource(name.c_str(), kResolution[0], kResolution[1]);
+}
+
+//! Grabs the first frame of the first source of a comma separated list
+void GrabFrame(const char* sources, CImg<double>& image)
+{
+	string name;
+	unique_ptr<KrabsFrameSource> source = OpenFirstSource(sources, name);
+	if (!source->Grab(image, source->is_live() ? 1 : 0))
+		throw CImgIOException("GrabFrame: No frame read from '%s'.", name.c_str());
+}
+
+//! Grabs the first frame of the first source of a comma separated list as 8-bit luminance
+void GrabFrame(const char* sources, CImg<unsigned char>& gray)
+{
+	string name;
+	unique_ptr<KrabsFrameSource> source = OpenFirstSource(sources, name);
+	if (!source->GrabGray(gray, source->is_live() ? 1 : 0))
+		throw CImgIOException("GrabFrame: No frame read from '%s'.", name.c_str());
+}
+
+void EdgeDetection(const char* filename, const char* sources, const double low_threshold, const double high_threshold, const float sigma)
 {
 	CImg<double> image;
+	CImg<double> gray;
 
 	if (strlen(filename))
 	{
 		image = CImg<>(filename);
 		if (image.width() > kMaxImageWidth)
 			image.resize(kResolution[0], kResolution[0]*image.height()/image.width());
+		gray = image.get_norm().normalize(0,255);
 	}
 	else
 	{
-		image.resize(kResolution[0],kResolution[1]);
-		image.load_camera(0,1,false,kResolution[0],kResolution[1]);
+		// edges only need luminance, so the frame is captured straight to 8 bits
+
+		CImg<unsigned char> luminance;
+		GrabFrame(sources, luminance);
+		image = luminance;
+		gray = image.get_normalize(0,255);
 	}
 
-	CImg<double> gray = image.get_norm().normalize(0,255);
 	(image,KrabsSobel(gray),KrabsCanny(gray, sigma, low_threshold, high_threshold)).display();
 }
 
-void FindButton(const char* filename, const double low_threshold, const double high_threshold, const float sigma, const char* button_label, const int min_area)
+void FindButton(const char* filename, const char* sources, const double low_threshold, const double high_threshold, const float sigma, const char* button_label, const int min_area, const double iou_threshold, const bool suppress_nested)
 {
 	const bool kLoadFromFile = strlen(filename) > 0;
 	const char* kCamFileName = "cam.jpg";
@@ -61,15 +134,15 @@ void FindButton(const char* filename, const double low_threshold, const double h
 	}
 	else
 	{
-		image.resize(kResolution[0],kResolution[1]);
-		image.load_camera(0,1,false,kResolution[0],kResolution[1]);
+		GrabFrame(sources, image);
 		FILE* file = cimg::fopen(kCamFileName, "wb+");
 		image.save_jpeg(file);
 		fclose(file);
 	}
 
 	vector<KrabsRegion> region_list;
-	KrabsLabeling(KrabsCanny(image.get_norm().normalize(0,255), sigma, low_threshold, high_threshold), region_list, min_area);
+	KrabsCompactLabeling(KrabsCanny(image.get_norm().normalize(0,255), sigma, low_threshold, high_threshold), region_list, min_area);
+	KrabsMergeRegions(region_list, iou_threshold, suppress_nested);
 
 	KrabsRegion region;
 	if (KrabsFindButton((kLoadFromFile?filename:kCamFileName), region_list, button_label, region, zoom_factor))
@@ -78,46 +151,612 @@ void FindButton(const char* filename, const double low_threshold, const double h
 	image.display();
 }
 
-//! Motion Detection
+//! Motion detection settings, from the command line
+struct MotionOptions
+{
+	float sigma;
+	int min_area;
+	double high_threshold;
+	int dilate;
+	bool show_threshold;
+	int connectivity;
+	char background_mode;
+	float learning_rate;
+	bool pipeline;
+	bool byte_frames;
+	bool gray_capture;   // frames are captured as 8-bit luminance, as nothing shows or records their color
+	int scale;
+	bool headless;
+	const char* events_file;
+	bool fused_mask;
+	int block;
+	double block_activity;
+	bool track;
+	bool predict;
+	bool vectors;
+	const char* clip_prefix;
+	int pre_frames;
+	int post_frames;
+	bool jpeg_clips;
+	double target_fps;   // negative for kWindowFps on live cameras shown in a window, as fast as possible otherwise
+	const char* mask_file;
+	const char* model_prefix;
+	double save_interval;
+	const char* heatmap_prefix;
+	int heatmap_cell;
+	double heatmap_interval;
+	KrabsSpanMask spans; // analysis area at analysis scale, loaded from mask_file for each camera, empty for the whole frame
+};
+
+//! Frame moving through the motion detection steps
+struct MotionFrame
+{
+	int width = 0;  // capture resolution
+	int height = 0;
+	CImg<double> image;
+	CImg<double> decimated;
+	CImg<double> gray;
+	CImg<double> threshold;
+	CImg<unsigned char> byte_luminance;
+	CImg<unsigned char> byte_gray;
+	CImg<unsigned char> byte_threshold;
+	CImg<unsigned char> active_blocks;
+	bool is_static = false;
+	vector<KrabsRegion> region_list;
+};
+
+//! Takes the newest frame: as color into image, or as luminance into byte_luminance or byte_gray with gray_capture
+bool TakeMotionFrame(const MotionOptions& options, KrabsCaptureThread& capture, MotionFrame& frame)
+{
+	if (!options.gray_capture)
+	{
+		if (!capture.TakeNewest(frame.image))
+			return false;
+		frame.width = frame.image.width();
+		frame.height = frame.image.height();
+		return true;
+	}
+
+	// at full scale the luminance is already the frame to blur
+
+	CImg<unsigned char>& luminance = options.scale > 1 ? frame.byte_luminance : frame.byte_gray;
+	if (!capture.TakeNewest(luminance))
+		return false;
+	frame.width = luminance.width();
+	frame.height = luminance.height();
+	return true;
+}
+
+//! Filters the frame at analysis scale: 1/scale of the capture resolution, with sigma and dilate scaled to match
+void FilterMotionFrame(const MotionOptions& options, MotionFrame& frame)
+{
+	const float kSigma = options.sigma/options.scale;
+
+	if (options.byte_frames)
+	{
+		if (options.scale > 1)
+		{
+			if (!options.gray_capture)
+				KrabsLuminance(frame.image, frame.byte_luminance);
+			KrabsBoxDecimate(frame.byte_luminance, options.scale, frame.byte_gray);
+		}
+		else if (!options.gray_capture)
+			KrabsLuminance(frame.image, frame.byte_gray);
+		KrabsFixedBlur(frame.byte_gray, kSigma, options.spans);
+	}
+	else if (options.scale > 1)
+	{
+		KrabsBoxDecimate(frame.image, options.scale, frame.decimated);
+		frame.gray = frame.decimated.get_norm().normalize(0,255).blur(kSigma,true,true);
+	}
+	else
+		frame.gray = frame.image.get_norm().normalize(0,255).blur(kSigma,true,true);
+}
+
+//! Motion mask of gray against the reference in one fused pass
 /**
- *  Based: http://www.pyimagesearch.com/2015/05/25/basic-motion-detection-and-tracking-with-python-and-opencv/
+ * With a block size, blocks whose summed difference stays below block_activity of a block changing by the
+ * threshold are left out, and a frame without active blocks is static: its mask is cleared and labeling skipped.
  */
-void MotionDetection(const float sigma, const int mim_area, const double high_threshold, const int dilate, const bool show_threshold)
+template<typename T>
+void FusedMotionMask(const MotionOptions& options, const CImg<T>& reference, const CImg<T>& gray, MotionFrame& frame)
 {
-	CImg<double> image(kResolution[0],kResolution[1]);
-	CImg<double> first_frame(kResolution[0],kResolution[1]);
+	const int kDilate = options.dilate/options.scale;
 
-	vector<KrabsRegion> region_list;
-	CImgDisplay display(image, "Motion Detection");
+	frame.is_static = false;
+	if (options.block <= 0)
+	{
+		KrabsMotionMask(reference, gray, options.high_threshold, kDilate, CImg<unsigned char>(), 0, options.spans, frame.byte_threshold);
+		return;
+	}
+
+	const double kMinSum = max(options.high_threshold, options.high_threshold*options.block_activity*options.block*options.block);
+	frame.is_static = !KrabsBlockMotion(reference, gray, options.block, kMinSum, options.spans, frame.active_blocks);
+
+	if (frame.is_static)
+		frame.byte_threshold.assign(gray.width(), gray.height(), 1, 1, 0);
+	else
+		KrabsMotionMask(reference, gray, options.high_threshold, kDilate, frame.active_blocks, options.block, options.spans, frame.byte_threshold);
+}
+
+//! Background model of a camera, and the file it is saved to
+struct MotionBackground
+{
+	KrabsBackgroundModel* model;
+	string file; // empty when the model is not saved
+	chrono::steady_clock::time_point saved;
+	KrabsModelWriter* writer;    // saves snapshots off the frame loop, set when file is
+	KrabsModelSnapshot snapshot; // model copy handed to the writer
+};
+
+//! File the background model of a camera is saved to, named after the model and the analysis size
+/**
+ * Runs with another -bg, -u8 or -sc keep their own file, rather than writing over a model they cannot restore.
+ */
+string MotionBackgroundFile(const MotionOptions& options, const int camera, const int width, const int height)
+{
+	const char *const kModel = (options.background_mode == 'g' || options.background_mode == 'G') ? "mixture" :
+		(options.byte_frames ? "average8" : "average");
+
+	return string(options.model_prefix) + "_" + to_string(camera) + "_" + kModel + "_" + to_string(width) + "x" + to_string(height) + ".bg";
+}
+
+//! Saves the background model once save_interval seconds passed since the last save, or right away with force
+void SaveMotionBackground(const MotionOptions& options, MotionBackground& background, const bool force)
+{
+	const chrono::steady_clock::time_point kNow = chrono::steady_clock::now();
 
-	first_frame.load_camera(0,1,false,kResolution[0],kResolution[1]).norm().normalize(0,255).blur(sigma,true,true);
-	display.display(image);
+	if (background.file.empty() || (!force && kNow - background.saved < chrono::duration<double>(options.save_interval)))
+		return;
 
-	while(!display.is_closed())
+	// the writer thread saves the copy, a failed save is reported at the next one and detection goes on. A forced
+	// save, the first or the last, is waited for, so its error is reported before the camera stops
+
+	background.saved = kNow;
+	try
 	{
-		image.load_camera(0,0,false,kResolution[0],kResolution[1]);
-		CImg<double> gray = image.get_norm().normalize(0,255).blur(sigma,true,true);
-		CImg<double> threshold = (first_frame-gray).abs().threshold(high_threshold).dilate(dilate);
+		background.model->Snapshot(background.snapshot);
+		background.writer->Submit(background.file, background.snapshot);
+	}
+	catch (CImgException& ex)
+	{
+		cerr << ex.what() << endl;
+	}
 
-		if (show_threshold)
-			display = threshold;
+	if (force)
+		background.writer->Flush();
+
+	const string kError = background.writer->TakeError();
+	if (!kError.empty())
+		cerr << kError << endl;
+}
+
+//! Motion mask of the frame, taken against the first frame in one fused pass when the background does not learn
+/**
+ * Motion dilated over excluded pixels is cleared, so regions stay inside the analysis area.
+ * A learning background is saved to its file every save_interval seconds.
+ */
+void MaskMotionFrame(const MotionOptions& options, MotionBackground& background, const MotionFrame& first_frame, MotionFrame& frame)
+{
+	const int kDilate = options.dilate/options.scale;
+
+	if (options.fused_mask && options.byte_frames)
+		FusedMotionMask(options, first_frame.byte_gray, frame.byte_gray, frame);
+	else if (options.fused_mask)
+		FusedMotionMask(options, first_frame.gray, frame.gray, frame);
+	else if (options.byte_frames)
+	{
+		background.model->Apply(frame.byte_gray, frame.byte_threshold);
+		KrabsDilateMask(frame.byte_threshold, kDilate);
+		SaveMotionBackground(options, background, false);
+	}
+	else
+	{
+		background.model->Apply(frame.gray, frame.threshold);
+		frame.threshold.dilate(kDilate);
+		options.spans.Clear(frame.threshold);
+		SaveMotionBackground(options, background, false);
+		return;
+	}
+
+	if (!frame.is_static)
+		options.spans.Clear(frame.byte_threshold);
+}
+
+template<typename T>
+void LabelMotionMask(const MotionOptions& options, const CImg<T>& threshold, vector<KrabsRegion>& region_list)
+{
+	const int kMinArea = options.min_area/(options.scale*options.scale);
+
+	if (options.connectivity == kFourConnected)
+		KrabsCompactLabeling<kFourConnected>(threshold, region_list, kMinArea, options.spans);
+	else
+		KrabsCompactLabeling<kEightConnected>(threshold, region_list, kMinArea, options.spans);
+}
+
+//! State the label step carries from one frame to the next
+struct MotionTracking
+{
+	KrabsRegionTracker* tracker; // gives regions their track id when set
+	CImg<double> previous_gray;  // gray frames motion vectors are matched against
+	CImg<unsigned char> previous_byte_gray;
+};
+
+//! Sets the motion vector of each region at analysis scale, then keeps gray as the previous frame
+template<typename T>
+void MotionVectors(const CImg<T>& gray, CImg<T>& previous, vector<KrabsRegion>& region_list)
+{
+	if (previous.is_sameXY(gray))
+		for (KrabsRegion& region : region_list)
+		{
+			const KrabsMotionVector kMotion = KrabsRegionVector(previous, gray, region, kVectorBlock, kVectorRange);
+			region.dx = kMotion.dx;
+			region.dy = kMotion.dy;
+		}
+
+	previous = gray;
+}
+
+//! Labels the motion regions, then gives them their motion vector and track id as options ask
+void LabelMotionFrame(const MotionOptions& options, MotionTracking& tracking, MotionFrame& frame)
+{
+	if (options.show_threshold)
+		return;
+
+	if (!frame.is_static)
+	{
+		if (options.byte_frames || options.fused_mask)
+			LabelMotionMask(options, frame.byte_threshold, frame.region_list);
 		else
+			LabelMotionMask(options, frame.threshold, frame.region_list);
+	}
+
+	if (options.vectors && options.byte_frames)
+		MotionVectors(frame.byte_gray, tracking.previous_byte_gray, frame.region_list);
+	else if (options.vectors)
+		MotionVectors(frame.gray, tracking.previous_gray, frame.region_list);
+
+	if (options.scale > 1)
+		for (KrabsRegion& region : frame.region_list)
+		{
+			KrabsScaleRegion(region, options.scale, frame.width, frame.height);
+			region.dx *= options.scale;
+			region.dy *= options.scale;
+		}
+
+	// static frames still count as misses for the tracks
+
+	if (tracking.tracker)
+		tracking.tracker->Update(frame.region_list);
+}
+
+void ShowMotionFrame(const MotionOptions& options, MotionFrame& frame, CImgDisplay& display)
+{
+	if (options.show_threshold && (options.byte_frames || options.fused_mask))
+		display = frame.byte_threshold;
+	else if (options.show_threshold)
+		display = frame.threshold;
+	else
+	{
+		while(!frame.region_list.empty())
 		{
-			KrabsLabeling(threshold, region_list, mim_area);
-			while(!region_list.empty())
+			KrabsRegion region = frame.region_list.back();
+			frame.region_list.pop_back();
+			DrawRect(region,frame.image);
+			if (region.dx || region.dy)
 			{
-				KrabsRegion region = region_list.back();
-				region_list.pop_back();
-				DrawRect(region,image);
+				const int kCenterX = (region.x0 + region.x1)/2;
+				const int kCenterY = (region.y0 + region.y1)/2;
+				frame.image.draw_arrow(kCenterX, kCenterY, kCenterX + kArrowScale*region.dx, kCenterY + kArrowScale*region.dy, kGreen);
 			}
-			display = image;
+			if (region.track)
+				frame.image.draw_text(region.x0 + 2, region.y0 + 2, "%u", kRed, 0, 1, 13, region.track);
 		}
+		display = frame.image;
+	}
+}
+
+//! Where motion detection results go: a window, NDJSON events and/or motion clips, the window being left out when headless
+struct MotionOutput
+{
+	CImgDisplay* display;
+	KrabsEventWriter* events;
+	KrabsClipRecorder* recorder;
+	KrabsFramePacer* pacer;
+	int camera;
+	unsigned long frame_count;
+	KrabsHeatmap* heatmap;          // accumulates motion masks when set
+	string heatmap_prefix;          // snapshots are saved to <heatmap_prefix>.png and .csv
+	chrono::steady_clock::time_point heatmap_saved;
+};
+
+//! Saves a heatmap snapshot once heatmap_interval seconds passed since the last one, or right away with force
+void SaveMotionHeatmap(const MotionOptions& options, MotionOutput& output, const bool force)
+{
+	const chrono::steady_clock::time_point kNow = chrono::steady_clock::now();
+
+	if (!output.heatmap || (!force && kNow - output.heatmap_saved < chrono::duration<double>(options.heatmap_interval)))
+		return;
+
+	output.heatmap_saved = kNow;
+	try
+	{
+		output.heatmap->SaveCsv((output.heatmap_prefix + ".csv").c_str());
+		output.heatmap->SavePng((output.heatmap_prefix + ".png").c_str());
+	}
+	catch (CImgException& ex)
+	{
+		cerr << ex.what() << endl;
+	}
+}
+
+bool IsMotionOutputOpen(const MotionOutput& output)
+{
+	return !stop_requested && (!output.display || !output.display->is_closed());
+}
+
+void OutputMotionFrame(const MotionOptions& options, MotionFrame& frame, MotionOutput& output, const KrabsCaptureThread& capture)
+{
+	const unsigned long kFrame = output.frame_count++;
+
+	if (output.events && !frame.region_list.empty())
+		output.events->WriteMotion(KrabsEventWriter::Now(), output.camera, kFrame, frame.region_list);
+
+	if (output.recorder)
+		output.recorder->Push(frame.image, !frame.region_list.empty());
+
+	if (output.heatmap)
+	{
+		if (frame.is_static)
+			output.heatmap->AddStatic();
+		else if (options.byte_frames || options.fused_mask)
+			output.heatmap->Add(frame.byte_threshold);
+		else
+			output.heatmap->Add(frame.threshold);
+		SaveMotionHeatmap(options, output, false);
+	}
+
+	if (output.display)
+	{
+		ShowMotionFrame(options, frame, *output.display);
+		output.display->set_title("Motion Detection %d (%.1f fps, %lu late, %lu dropped frames)", output.camera,
+			output.pacer->fps(), output.pacer->late(), capture.dropped());
+	}
+	else
+		frame.region_list.clear();
+
+	output.pacer->Wait();
+}
+
+//! Runs each motion detection step on its own thread, so consecutive frames are processed at the same time
+/**
+ * Frames are taken from a fixed pool and handed from step to step through bounded queues: while frame N is labeled,
+ * frame N+1 is masked and frame N+2 is filtered. The output stays on the calling thread.
+ */
+void PipelineMotionDetection(const MotionOptions& options, MotionBackground& background, MotionTracking& tracking, const MotionFrame& first_frame, KrabsCaptureThread& capture, MotionOutput& output)
+{
+	const int kPipelineFrames = 4;
+
+	vector<MotionFrame> frames(kPipelineFrames);
+	KrabsBoundedQueue<MotionFrame*> free_frames(kPipelineFrames);
+	KrabsBoundedQueue<MotionFrame*> filtered(1);
+	KrabsBoundedQueue<MotionFrame*> masked(1);
+	KrabsBoundedQueue<MotionFrame*> labeled(1);
+
+	for (MotionFrame& frame : frames)
+		free_frames.Push(&frame);
+
+	KrabsPipelineStage<MotionFrame*> filter(free_frames, filtered, [&](MotionFrame* frame) {
+		if (stop_requested || !TakeMotionFrame(options, capture, *frame))
+			return false;
+		FilterMotionFrame(options, *frame);
+		return true;
+	});
+	KrabsPipelineStage<MotionFrame*> mask(filtered, masked, [&](MotionFrame* frame) {
+		MaskMotionFrame(options, background, first_frame, *frame);
+		return true;
+	});
+	KrabsPipelineStage<MotionFrame*> label(masked, labeled, [&](MotionFrame* frame) {
+		LabelMotionFrame(options, tracking, *frame);
+		return true;
+	});
 
-		display.wait(100);
+	filter.Start();
+	mask.Start();
+	label.Start();
+
+	MotionFrame* frame;
+	while(IsMotionOutputOpen(output) && labeled.Pop(frame))
+	{
+		OutputMotionFrame(options, *frame, output, capture);
+		free_frames.Push(frame);
 	}
+
+	// closing the pool stops the first stage, and each stage closes the queue after it once drained
+
+	free_frames.Close();
+	while(labeled.Pop(frame));
+
+	filter.Join();
+	mask.Join();
+	label.Join();
 }
 
-void ShowRegions(const char* filename, const double low_threshold, const double high_threshold, const float sigma, const int min_area)
+//! Motion Detection
+/**
+ *  Based: http://www.pyimagesearch.com/2015/05/25/basic-motion-detection-and-tracking-with-python-and-opencv/
+ */
+void MotionDetection(MotionOptions options, KrabsCaptureThread& capture, const int camera, KrabsEventWriter* events)
+{
+	MotionFrame first_frame;
+	first_frame.image.assign(kResolution[0],kResolution[1]);
+
+	KrabsRunningAverage average(options.learning_rate, options.high_threshold);
+	KrabsGaussianMixture mixture(options.learning_rate > 0 ? options.learning_rate : kMixtureLearningRate);
+	unique_ptr<KrabsModelWriter> writer;
+	if (strlen(options.model_prefix))
+		writer.reset(new KrabsModelWriter());
+	MotionBackground background = {(options.background_mode == 'g' || options.background_mode == 'G') ? static_cast<KrabsBackgroundModel*>(&mixture) : &average,
+		string(), chrono::steady_clock::now(), writer.get(), KrabsModelSnapshot()};
+
+	KrabsRegionTracker tracker(kTrackIoU, kTrackMisses, options.predict);
+	MotionTracking tracking;
+	tracking.tracker = options.track ? &tracker : 0;
+
+	CImgDisplay display;
+	if (!options.headless)
+		display.assign(first_frame.image, "Motion Detection");
+
+	unique_ptr<KrabsClipRecorder> recorder;
+	if (strlen(options.clip_prefix))
+		recorder.reset(new KrabsClipRecorder((string(options.clip_prefix) + "_" + to_string(camera)).c_str(), options.pre_frames, options.post_frames,
+			options.jpeg_clips ? KrabsClipRecorder::kJpeg : KrabsClipRecorder::kRaw));
+
+	capture.Start();
+
+	if (!TakeMotionFrame(options, capture, first_frame))
+		return;
+	if (strlen(options.mask_file))
+		options.spans = KrabsSpanMask::Load(options.mask_file, first_frame.width, first_frame.height).Scaled(options.scale);
+	FilterMotionFrame(options, first_frame);
+	if (writer && options.byte_frames)
+		background.file = MotionBackgroundFile(options, camera, first_frame.byte_gray.width(), first_frame.byte_gray.height());
+	else if (writer)
+		background.file = MotionBackgroundFile(options, camera, first_frame.gray.width(), first_frame.gray.height());
+	if (background.file.empty() && options.byte_frames)
+		background.model->Initialize(first_frame.byte_gray);
+	else if (background.file.empty())
+		background.model->Initialize(first_frame.gray);
+	else
+	{
+		// a restored model picks up where the previous run left off, the fixed reference of the fused mask included
+
+		const bool kRestored = options.byte_frames ? background.model->Load(background.file.c_str(), first_frame.byte_gray) :
+			background.model->Load(background.file.c_str(), first_frame.gray);
+
+		if (kRestored && options.fused_mask && options.byte_frames)
+			average.ByteBackground(first_frame.byte_gray);
+		else if (kRestored && options.fused_mask)
+			first_frame.gray = average.background();
+
+		if (kRestored)
+			cerr << "Camera " << camera << ": background restored from " << background.file << endl;
+		else
+			SaveMotionBackground(options, background, true);
+	}
+
+	// recordings, generated frames and headless runs are not paced by default, so replays run at full speed
+
+	KrabsFramePacer pacer(options.target_fps >= 0 ? options.target_fps : (!options.headless && capture.is_live() ? kWindowFps : 0));
+	KrabsHeatmap heatmap(max(1, options.heatmap_cell/options.scale));
+	MotionOutput output = {options.headless ? 0 : &display, events, recorder.get(), &pacer, camera, 0,
+		strlen(options.heatmap_prefix) ? &heatmap : 0, string(options.heatmap_prefix) + "_" + to_string(camera), chrono::steady_clock::now()};
+
+	if (options.pipeline)
+		PipelineMotionDetection(options, background, tracking, first_frame, capture, output);
+	else
+	{
+		MotionFrame frame;
+		while(IsMotionOutputOpen(output) && TakeMotionFrame(options, capture, frame))
+		{
+			FilterMotionFrame(options, frame);
+			MaskMotionFrame(options, background, first_frame, frame);
+			LabelMotionFrame(options, tracking, frame);
+			OutputMotionFrame(options, frame, output, capture);
+		}
+	}
+
+	capture.Stop();
+
+	if (!options.fused_mask)
+		SaveMotionBackground(options, background, true);
+	SaveMotionHeatmap(options, output, true);
+
+	cerr << "Camera " << camera << ": " << pacer.frames() << " frames, " << pacer.average_fps() << " fps, "
+		<< pacer.late() << " late, " << capture.dropped() << " dropped" << endl;
+}
+
+//! Writes the error a camera thread failed with to the standard error
+void ReportCameraError(const int camera, const exception_ptr& error)
+{
+	try
+	{
+		rethrow_exception(error);
+	}
+	catch (exception& ex)
+	{
+		cerr << "Camera " << camera << ": " << ex.what() << endl;
+	}
+	catch (...)
+	{
+		cerr << "Camera " << camera << ": unknown error" << endl;
+	}
+}
+
+//! Runs motion detection on each camera of a comma separated list, in parallel
+/**
+ * Each entry is opened with KrabsOpenFrameSource: a camera index, a video file, a raw video, an image directory or
+ * a synthetic source. Each camera has its own capture and its own thread, and every camera writes to the same events file.
+ * A camera that fails is reported at once and stops the others, then its error is rethrown.
+ */
+void MultiCameraMotionDetection(const MotionOptions& options, const char* cameras)
+{
+	vector<unique_ptr<KrabsCaptureThread>> captures;
+
+	const string kCameras(cameras);
+	for (size_t begin = 0; begin < kCameras.size();)
+	{
+		size_t end = kCameras.find(',', begin);
+		if (end == string::npos)
+			end = kCameras.size();
+
+		const string kCamera = kCameras.substr(begin, end - begin);
+		if (!kCamera.empty())
+		{
+			captures.emplace_back(new KrabsCaptureThread(KrabsOpenFrameSource(kCamera.c_str(), kResolution[0], kResolution[1]), kResolution[0], kResolution[1],
+				options.gray_capture));
+		}
+		begin = end + 1;
+	}
+
+	unique_ptr<KrabsEventWriter> events;
+	if (options.headless || strlen(options.events_file))
+		events.reset(new KrabsEventWriter(options.events_file));
+
+	if (captures.size() == 1)
+	{
+		MotionDetection(options, *captures[0], 0, events.get());
+		return;
+	}
+
+	vector<thread> threads;
+	vector<exception_ptr> errors(captures.size());
+
+	for (size_t i = 0; i < captures.size(); i++)
+		threads.emplace_back([&, i] {
+			try
+			{
+				MotionDetection(options, *captures[i], (int)i, events.get());
+			}
+			catch (...)
+			{
+				// reported right away and the other cameras stopped, as live cameras would otherwise run on forever
+
+				errors[i] = current_exception();
+				ReportCameraError((int)i, errors[i]);
+				stop_requested = true;
+			}
+		});
+
+	for (thread& camera_thread : threads)
+		camera_thread.join();
+
+	for (const exception_ptr& error : errors)
+		if (error)
+			rethrow_exception(error);
+}
+
+void ShowRegions(const char* filename, const char* sources, const double low_threshold, const double high_threshold, const float sigma, const int min_area, const double iou_threshold, const bool suppress_nested)
 {
 	CImg<double> image;
 
@@ -129,12 +768,12 @@ void ShowRegions(const char* filename, const double low_threshold, const double
 	}
 	else
 	{
-		image.resize(kResolution[0],kResolution[1]);
-		image.load_camera(0,1,false,kResolution[0],kResolution[1]);
+		GrabFrame(sources, image);
 	}
 
 	vector<KrabsRegion> region_list;
-	KrabsLabeling(KrabsCanny(image.get_norm().normalize(0,255), sigma, low_threshold, high_threshold), region_list, min_area);
+	KrabsCompactLabeling(KrabsCanny(image.get_norm().normalize(0,255), sigma, low_threshold, high_threshold), region_list, min_area);
+	KrabsMergeRegions(region_list, iou_threshold, suppress_nested);
 	while(!region_list.empty())
 	{
 		KrabsRegion region = region_list.back();
@@ -145,11 +784,262 @@ void ShowRegions(const char* filename, const double low_threshold, const double
 	image.display();
 }
 
+void ShowContours(const char* filename, const char* sources, const double low_threshold, const double high_threshold, const float sigma, const int min_area, const double tolerance)
+{
+	CImg<double> image;
+
+	if (strlen(filename))
+	{
+		image = CImg<>(filename);
+		if (image.width() > kMaxImageWidth)
+			image.resize(kResolution[0],kResolution[0]*image.height()/image.width());
+	}
+	else
+	{
+		GrabFrame(sources, image);
+	}
+
+	vector<KrabsContour> contour_list;
+	KrabsContourLabeling(KrabsCanny(image.get_norm().normalize(0,255), sigma, low_threshold, high_threshold), contour_list, min_area);
+	while(!contour_list.empty())
+	{
+		vector<pair<int,int>> polygon = KrabsContourPolygon(contour_list.back(), tolerance);
+		contour_list.pop_back();
+
+		CImg<int> points(polygon.size(),2);
+		cimg_forX(points,i)
+		{
+			points(i,0) = polygon[i].first;
+			points(i,1) = polygon[i].second;
+		}
+		image.draw_polygon(points, kRed, 1, ~0U);
+	}
+
+	image.display();
+}
+
+//! Prints the outcome of a check, returning whether it passed
+bool ReportCheck(const string& name, const bool passed)
+{
+	cout << (passed ? "ok   " : "FAIL ") << name << endl;
+	return passed;
+}
+
+//! Checks the motion kernels against the CImg operations they stand for, on synthetic frames
+bool CheckMotionKernels()
+{
+	const int kBlock = 8;
+	const float kBlurSigma = 2.0f;
+
+	KrabsSyntheticSource source(kResolution[0], kResolution[1], 0, 1);
+	CImg<double> first, frame;
+	source.Grab(first);
+	source.Grab(frame, 4);
+
+	CImg<unsigned char> byte_reference, byte_gray;
+	KrabsLuminance(first, byte_reference);
+	KrabsLuminance(frame, byte_gray);
+	const CImg<double> kReference(byte_reference), kGray(byte_gray);
+	bool passed = true;
+
+	for (const double kThreshold : {8.0, 25.0})
+		for (const int kDilate : {1, 6, 21})
+		{
+			const CImg<unsigned char> kDifference = (kReference - kGray).abs().threshold(kThreshold);
+			const CImg<unsigned char> kExpected = kDifference.get_dilate(kDilate);
+			const string kName = " threshold " + to_string((int)kThreshold) + ", dilate " + to_string(kDilate);
+
+			CImg<unsigned char> mask, active;
+			KrabsMotionMask(kReference, kGray, kThreshold, kDilate, mask);
+			passed = ReportCheck("KrabsMotionMask double" + kName, mask == kExpected) && passed;
+
+			KrabsMotionMask(byte_reference, byte_gray, kThreshold, kDilate, mask);
+			passed = ReportCheck("KrabsMotionMask 8-bit" + kName, mask == kExpected) && passed;
+
+			// blocks whose sum stays below the threshold cannot hold a pixel above it, so the mask is exact
+
+			KrabsBlockMotion(byte_reference, byte_gray, kBlock, kThreshold, active);
+			KrabsMotionMask(byte_reference, byte_gray, kThreshold, kDilate, active, kBlock, mask);
+			passed = ReportCheck("KrabsMotionMask active blocks" + kName, mask == kExpected) && passed;
+
+			mask = kDifference;
+			KrabsDilateMask(mask, kDilate);
+			passed = ReportCheck("KrabsDilateMask" + kName, mask == kExpected) && passed;
+		}
+
+	// a masked blur gives the whole frame blur inside the mask and leaves the rest as it was
+
+	const unsigned char kInclude = 1;
+	CImg<unsigned char> include(kResolution[0], kResolution[1], 1, 1, 0);
+	include.draw_ellipse(kResolution[0]/2, kResolution[1]/2, kResolution[0]/3.0f, kResolution[1]/4.0f, 0.5f, &kInclude);
+
+	CImg<unsigned char> whole(byte_gray), masked(byte_gray);
+	KrabsFixedBlur(whole, kBlurSigma);
+	KrabsFixedBlur(masked, kBlurSigma, KrabsSpanMask(include));
+
+	bool same = true;
+	cimg_forXY(include,x,y)
+		same = same && masked(x,y) == (include(x,y) ? whole(x,y) : byte_gray(x,y));
+	passed = ReportCheck("KrabsFixedBlur masked", same) && passed;
+
+	// interleaved conversions against the planar frame and KrabsLuminance
+
+	const CImg<unsigned char> kPlanar(frame);
+	const CImg<unsigned char> kRgb = kPlanar.get_permute_axes("cxyz");
+	const CImg<unsigned char> kBgr = kPlanar.get_mirror('c').permute_axes("cxyz");
+	const long kStride = 3L*kPlanar.width();
+
+	CImg<unsigned char> luminance, expected_luminance, byte_planar;
+	CImg<float> float_planar;
+	KrabsLuminance(CImg<double>(kPlanar), expected_luminance);
+
+	KrabsInterleavedLuminance(kRgb.data(), kPlanar.width(), kPlanar.height(), kStride, kRgbOrder, luminance);
+	passed = ReportCheck("KrabsInterleavedLuminance RGB", luminance == expected_luminance) && passed;
+	KrabsInterleavedLuminance(kBgr.data(), kPlanar.width(), kPlanar.height(), kStride, kBgrOrder, luminance);
+	passed = ReportCheck("KrabsInterleavedLuminance BGR", luminance == expected_luminance) && passed;
+
+	KrabsDeinterleave(kRgb.data(), kPlanar.width(), kPlanar.height(), kStride, kRgbOrder, byte_planar);
+	passed = ReportCheck("KrabsDeinterleave RGB 8-bit", byte_planar == kPlanar) && passed;
+	KrabsDeinterleave(kBgr.data(), kPlanar.width(), kPlanar.height(), kStride, kBgrOrder, float_planar);
+	passed = ReportCheck("KrabsDeinterleave BGR float", float_planar == CImg<float>(kPlanar)) && passed;
+
+	return passed;
+}
+
+//! Checks region merging on a lone button and on the same button inside a frame outline
+bool CheckRegionMerging()
+{
+	const auto kBox = [](const int x0, const int y0, const int x1, const int y1) {
+		KrabsRegion region;
+		region.x0 = x0;
+		region.y0 = y0;
+		region.x1 = x1;
+		region.y1 = y1;
+		region.pixels = (unsigned int)(2*(x1 - x0 + y1 - y0));
+		return region;
+	};
+
+	const KrabsRegion kButton = kBox(100, 100, 219, 139);
+	const KrabsRegion kFrame = kBox(0, 0, kResolution[0] - 1, kResolution[1] - 1);
+	const vector<KrabsRegion> kLoneButton = {kBox(110, 110, 121, 129), kBox(130, 110, 141, 129), kBox(150, 110, 161, 129), kButton};
+	const auto kBoxes = [](const vector<KrabsRegion>& regions) {
+		string boxes;
+		for (const KrabsRegion& region : regions)
+			boxes += to_string(region.x0) + "," + to_string(region.y0) + "," + to_string(region.x1) + "," + to_string(region.y1) + " ";
+		return boxes;
+	};
+
+	// the button alone covers most of the box around all regions, its glyphs go all the same
+
+	vector<KrabsRegion> regions(kLoneButton);
+	KrabsMergeRegions(regions, 1.0, true);
+	bool passed = ReportCheck("KrabsMergeRegions lone button drops its glyphs", kBoxes(regions) == kBoxes({kButton}));
+
+	// a frame is no button, so it keeps the button, which still drops its glyphs
+
+	regions = kLoneButton;
+	regions.push_back(kFrame);
+	KrabsMergeRegions(regions, 1.0, true);
+	passed = ReportCheck("KrabsMergeRegions frame keeps its button", kBoxes(regions) == kBoxes({kFrame, kButton})) && passed;
+
+	// nothing asked, nothing changed
+
+	regions = kLoneButton;
+	KrabsMergeRegions(regions, 1.0, false);
+	passed = ReportCheck("KrabsMergeRegions off keeps regions in order", kBoxes(regions) == kBoxes(kLoneButton)) && passed;
+
+	return passed;
+}
+
+//! Events written to filename without their timestamps, sorted, as cameras write concurrently
+vector<string> ReadEvents(const string& filename)
+{
+	vector<string> events;
+	ifstream file(filename.c_str());
+
+	for (string line; getline(file, line);)
+	{
+		const size_t kCamera = line.find(",\"camera\"");
+		events.push_back(kCamera == string::npos ? line : line.substr(kCamera));
+	}
+
+	sort(events.begin(), events.end());
+	return events;
+}
+
+//! Runs headless motion detection on sources, returning its events
+vector<string> ReplayEvents(MotionOptions options, const char* sources, const string& filename)
+{
+	remove(filename.c_str());
+	options.events_file = filename.c_str();
+	MultiCameraMotionDetection(options, sources);
+
+	vector<string> events = ReadEvents(filename);
+	remove(filename.c_str());
+	return events;
+}
+
+//! Headless self-check: motion kernels against CImg, region merging, then replays of synthetic sources that must give the same events
+/**
+ * Runs the same sources with the settings of options, then with the pipeline, the 8-bit path, gray capture and
+ * decimation switched, each pair of runs being expected to write the same events. Made for CI: no window, no
+ * camera, and the return value says whether every check passed.
+ */
+bool VerifyMotionDetection(MotionOptions options)
+{
+	const char* kSources = "synthetic:60:1,synthetic:40:2";
+	const string kEvents = string(cimg::temporary_path()) + "/krabs_verify_events.json";
+
+	bool passed = CheckMotionKernels();
+	passed = CheckRegionMerging() && passed;
+
+	options.headless = true;
+	options.show_threshold = false;
+	options.target_fps = 0;
+	options.clip_prefix = "";
+	options.model_prefix = "";
+	options.heatmap_prefix = "";
+	options.mask_file = "";
+	options.byte_frames = false;
+	options.gray_capture = false;
+	options.pipeline = false;
+	options.scale = 1;
+
+	// pairs of settings expected to give the same events
+
+	MotionOptions byte_options = options;
+	byte_options.byte_frames = true;
+	MotionOptions gray_options = byte_options;
+	gray_options.gray_capture = true;
+	MotionOptions scaled_options = gray_options;
+	scaled_options.scale = 2;
+
+	const struct { const char* name; MotionOptions first; MotionOptions second; bool pipeline; } kPairs[] = {
+		{"replay repeats", options, options, false},
+		{"pipeline matches sequential", options, options, true},
+		{"8-bit pipeline matches sequential", byte_options, byte_options, true},
+		{"8-bit gray capture matches color capture", byte_options, gray_options, false},
+		{"decimated 8-bit pipeline matches sequential", scaled_options, scaled_options, true},
+	};
+
+	for (const auto& kPair : kPairs)
+	{
+		MotionOptions second = kPair.second;
+		second.pipeline = kPair.pipeline;
+
+		const vector<string> kFirst = ReplayEvents(kPair.first, kSources, kEvents);
+		const vector<string> kSecond = ReplayEvents(second, kSources, kEvents);
+		passed = ReportCheck(string(kPair.name) + " (" + to_string(kFirst.size()) + " events)", !kFirst.empty() && kFirst == kSecond) && passed;
+	}
+
+	return passed;
+}
+
 int main(int argc, char **argv)
 {
 	cimg_usage("Retrieve command line arguments");
 	const char*  filename       = cimg_option("-i","","Input image file");
-	const char   type           = cimg_option("-t",'m',"Algorithm type: e - Edge detection, b - Find button by Label, m = Motion detection");
+	const char   type           = cimg_option("-t",'m',"Algorithm type: e - Edge detection, b - Find button by Label, m = Motion detection, l - Show regions, c - Show contours, v - Verify motion detection (headless, exits with 1 on a failed check)");
 	const double low_threshold  = cimg_option("-lt",15.0,"Low threshold");
 	const double high_threshold = cimg_option("-ht",40.0,"High threshold");
 	const float  sigma          = cimg_option("-s",1.4f,"Sigma");
@@ -157,25 +1047,79 @@ int main(int argc, char **argv)
 	const int    min_area       = cimg_option("-a",5000,"Min area");
 	const bool   show_threshold = cimg_option("-ts",false,"Show threshold");
 	const int    dilate         = cimg_option("-d",20,"Dilate");
+	const int    connectivity   = cimg_option("-cn",4,"Motion region connectivity (4 or 8)");
+	const char   background_mode= cimg_option("-bg",'a',"Background model: a - Running average, g - Mixture of gaussians");
+	const float  learning_rate  = cimg_option("-lr",0.0f,"Background learning rate (0 keeps the first frame, mixture of gaussians uses 0.01)");
+	const double tolerance      = cimg_option("-pt",1.0,"Contour polygon tolerance");
+	const double iou_threshold  = cimg_option("-iou",1.0,"IoU above which regions are merged, 1 merges none");
+	const bool   suppress_nested= cimg_option("-sn",false,"Suppress glyph sized regions nested in button sized regions");
+	const bool   pipeline       = cimg_option("-pl",false,"Run motion detection steps on separate threads");
+	const bool   byte_frames    = cimg_option("-u8",false,"Run motion detection on 8-bit luminance frames");
+	const int    scale          = cimg_option("-sc",1,"Motion analysis scale: 1 - Full resolution, 2 or 4 - Decimated by 2 or 4");
+	const bool   headless       = cimg_option("-hl",false,"Motion detection without window, writing events only");
+	const char*  events_file    = cimg_option("-ev","","Motion events NDJSON file (stdout when headless and empty)");
+	const int    block          = cimg_option("-bk",0,"Motion block size skipping static blocks and frames, needs -bg a and -lr 0 (0 disables it)");
+	const double block_activity = cimg_option("-ba",0.05,"Fraction of a motion block changing by the threshold to make it active (0 keeps every changed pixel)");
+	const bool   track          = cimg_option("-tk",false,"Track motion regions across frames under persistent ids");
+	const bool   predict        = cimg_option("-kf",true,"Predict tracked region motion with a constant velocity Kalman filter");
+	const bool   vectors        = cimg_option("-mv",false,"Estimate motion region vectors by block matching");
+	const char*  clip_prefix    = cimg_option("-rc","","Motion clip path prefix, clips are saved as <prefix>_<camera>_<timestamp> (empty disables recording)");
+	const int    pre_frames     = cimg_option("-rp",30,"Frames recorded before motion");
+	const int    post_frames    = cimg_option("-rt",30,"Frames recorded after motion");
+	const bool   jpeg_clips     = cimg_option("-rj",false,"Record clips as JPEG images instead of raw rgb24 video");
+	const double target_fps     = cimg_option("-fps",-1.0,"Motion detection target frame rate (0 runs as fast as possible, negative paces live cameras shown in a window to 10 fps and runs anything else as fast as possible)");
+	const char*  mask_file      = cimg_option("-mk","","Motion analysis mask: image whose non zero pixels are analyzed, or .txt polygons (+ x y ... includes, - x y ... excludes)");
+	const char*  model_prefix   = cimg_option("-bm","","Background model path prefix, saved as <prefix>_<camera>_<model>_<width>x<height>.bg and restored on start (empty disables it)");
+	const double save_interval  = cimg_option("-bi",60.0,"Seconds between background model saves");
+	const char*  heatmap_prefix = cimg_option("-hm","","Motion heatmap path prefix, snapshots are saved as <prefix>_<camera>.png and .csv (empty disables it)");
+	const int    heatmap_cell   = cimg_option("-hc",8,"Motion heatmap cell side, in capture pixels");
+	const double heatmap_interval= cimg_option("-hs",60.0,"Seconds between motion heatmap snapshots");
+	const char*  cameras        = cimg_option("-cm","0","Frame sources: comma separated camera indexes, video files, .rgb raw videos, image directories or synthetic[:frames[:seed]], motion detection runs each on its own thread, other modes read the first one");
+
+	const MotionOptions kMotionOptions = {sigma, min_area, high_threshold, dilate, show_threshold && !headless, connectivity, background_mode,
+		learning_rate, pipeline, byte_frames, byte_frames && headless && !strlen(clip_prefix), scale, headless, events_file,
+		background_mode != 'g' && background_mode != 'G' && learning_rate <= 0, block, block_activity, track, predict, vectors,
+		clip_prefix, pre_frames > 0 ? pre_frames : 0, post_frames > 0 ? post_frames : 0, jpeg_clips, target_fps,
+		mask_file, model_prefix, save_interval, heatmap_prefix, heatmap_cell, heatmap_interval, KrabsSpanMask()};
+	int status = 0;
 
 	try
 	{
 		switch(type)
 		{
 			case 'e':
-			case 'E': EdgeDetection(filename, low_threshold, high_threshold, sigma); break;
+			case 'E': EdgeDetection(filename, cameras, low_threshold, high_threshold, sigma); break;
 			case 'b':
-			case 'B': FindButton(filename, low_threshold, high_threshold, sigma, button_label, min_area); break;
+			case 'B': FindButton(filename, cameras, low_threshold, high_threshold, sigma, button_label, min_area, iou_threshold, suppress_nested); break;
 			case 'm':
-			case 'M': MotionDetection(sigma, min_area, high_threshold, dilate, show_threshold); break;
+			case 'M':
+			{
+				if (scale != 1 && scale != 2 && scale != 4)
+					throw CImgArgumentException("Motion analysis scale %d is not 1, 2 or 4.", scale);
+				if (block > 0 && !kMotionOptions.fused_mask)
+					throw CImgArgumentException("Motion block size %d needs the running average background without learning (-bg a -lr 0).", block);
+
+				// a headless run ends on a signal, flushing its events, clips, background model and heatmap
+
+				signal(SIGINT, RequestStop);
+				signal(SIGTERM, RequestStop);
+
+				MultiCameraMotionDetection(kMotionOptions, cameras);
+				break;
+			}
+			case 'v':
+			case 'V': status = VerifyMotionDetection(kMotionOptions) ? 0 : 1; break;
 			case 'l':
-			case 'L': ShowRegions(filename, low_threshold, high_threshold, sigma, min_area); break;
+			case 'L': ShowRegions(filename, cameras, low_threshold, high_threshold, sigma, min_area, iou_threshold, suppress_nested); break;
+			case 'c':
+			case 'C': ShowContours(filename, cameras, low_threshold, high_threshold, sigma, min_area, tolerance); break;
 		}
 	}
 	catch(exception &ex)
 	{
 		std::cout << "Error:" << ex.what();
+		status = 1;
 	}
 
-	return 0;
+	return status;
 }
@@ -5,6 +5,7 @@
 #include <cmath>
 #include <cstdio>
 #include <iostream>
+#include <limits>
 #include <string>
 
 using namespace cimg_library;
@@ -19,15 +20,6 @@ using namespace std;
 #define SW_INBOUND(img,x,y) ((x) > 0 && (y) < (img).height()-1)
 #define WE_INBOUND(x)       ((x) > 0)
 
-#define NW_COORD(x,y) (x)-1,(y)-1
-#define NO_COORD(x,y) (x),(y)-1
-#define NE_COORD(x,y) (x)+1,(y)-1
-#define EA_COORD(x,y) (x)+1,(y)
-#define SE_COORD(x,y) (x)+1,(y)+1
-#define SO_COORD(x,y) (x),(y)+1
-#define SW_COORD(x,y) (x)-1,(y)+1
-#define WE_COORD(x,y) (x)-1,(y)
-
 #define NW(img,x,y) (img)((x)-1,(y)-1)
 #define NO(img,x,y) (img)((x),(y)-1)
 #define NE(img,x,y) (img)((x)+1,(y)-1)
@@ -39,6 +31,43 @@ using namespace std;
 
 const int kParallelChunk = 100;
 
+//! Neighbor offsets, clockwise from north west (8-connected) or north (4-connected)
+template<int connectivity> struct Neighborhood;
+
+template<> struct Neighborhood<kFourConnected>
+{
+	static constexpr int kX[4] = { 0, 1, 0,-1};
+	static constexpr int kY[4] = {-1, 0, 1, 0};
+};
+
+template<> struct Neighborhood<kEightConnected>
+{
+	static constexpr int kX[8] = {-1, 0, 1, 1, 1, 0,-1,-1};
+	static constexpr int kY[8] = {-1,-1,-1, 0, 1, 1, 1, 0};
+};
+
+constexpr int Neighborhood<kFourConnected>::kX[4];
+constexpr int Neighborhood<kFourConnected>::kY[4];
+constexpr int Neighborhood<kEightConnected>::kX[8];
+constexpr int Neighborhood<kEightConnected>::kY[8];
+
+inline bool InBound(const int width, const int height, const int x, const int y)
+{
+	return x >= 0 && y >= 0 && x < width && y < height;
+}
+
+inline unsigned int Offset(const int width, const int x, const int y)
+{
+	return static_cast<unsigned int>(x + y*width);
+}
+
+KrabsFloodStack& KrabsThreadFloodStack(const unsigned long size)
+{
+	static thread_local KrabsFloodStack stack;
+	stack.Reserve(size);
+	return stack;
+}
+
 CImg<double> KrabsSobel(const CImg<double>& gray)
 {
 	CImg<double> gradient_x = gray.get_convolve(kSobelKernelX).sqr().normalize(0, 255);
@@ -60,28 +89,26 @@ inline double AngleSum(const double angle, const double value)
 	return result < 0 ? result + 360 : result;
 }
 
+template<int connectivity>
 CImg<unsigned char> Hysteresis(const CImg<double> &gradient, const double high_threshold, const double low_threshold)
 {
-	vector<pair<int, int>> neighborhood;
 	CImg<unsigned char> edge_trace = gradient.get_fill(0);
 
-	#pragma omp parallel for \
-	private(neighborhood) \
-	shared(gradient,edge_trace) \
-	schedule(dynamic,kParallelChunk)
-	cimg_forXY(gradient,x,y)
+	#pragma omp parallel shared(gradient,edge_trace)
 	{
-		if (!edge_trace(x,y) && gradient(x,y) >= high_threshold)
+		KrabsFloodStack &neighborhood = KrabsThreadFloodStack((unsigned long)gradient.width()*gradient.height());
+
+		#pragma omp for schedule(dynamic,kParallelChunk)
+		cimg_forXY(gradient,x,y)
 		{
-			edge_trace(x,y) = kEdge;
+			if (!edge_trace(x,y) && gradient(x,y) >= high_threshold)
+			{
+				edge_trace(x,y) = kEdge;
 
-			CheckNeighborhood(neighborhood, gradient, edge_trace, x, y, low_threshold);
+				CheckNeighborhood<connectivity>(neighborhood, gradient, edge_trace, Offset(gradient.width(), x, y), low_threshold);
 
-			while(!neighborhood.empty())
-			{
-				pair<int,int> point = neighborhood.back();
-				neighborhood.pop_back();
-				CheckNeighborhood(neighborhood, gradient, edge_trace, point.first, point.second, low_threshold);
+				while(!neighborhood.IsEmpty())
+					CheckNeighborhood<connectivity>(neighborhood, gradient, edge_trace, neighborhood.Pop(), low_threshold);
 			}
 		}
 	}
@@ -89,83 +116,38 @@ CImg<unsigned char> Hysteresis(const CImg<double> &gradient, const double high_t
 	return edge_trace;
 }
 
-inline void CheckNeighborhood(vector<pair<int, int>> &neighborhood, const CImg<double> &gradient, CImg<unsigned char> &edge_trace, const int x, const int y, const double threshold)
+template<int connectivity>
+inline void CheckNeighborhood(KrabsFloodStack &neighborhood, const CImg<double> &gradient, CImg<unsigned char> &edge_trace, const unsigned int offset, const double threshold)
 {
-	// check 8-connected pixels
+	typedef Neighborhood<connectivity> Neighbors;
 
-	#pragma omp critical (NW)
-	{
-		if (NW_INBOUND(x,y) && !NW(edge_trace,x,y) && NW(gradient,x,y) >= threshold)
-		{
-			NW(edge_trace,x,y) = kEdge;
-			neighborhood.push_back(pair<int,int>(NW_COORD(x,y)));
-		}
-	}
+	const int x = offset % gradient.width();
+	const int y = offset / gradient.width();
+	unsigned char *const kTrace = edge_trace.data();
 
-	#pragma omp critical (NO)
-	{
-		if (NO_INBOUND(y) && !NO(edge_trace,x,y) && NO(gradient,x,y) >= threshold)
-		{
-			NO(edge_trace,x,y) = kEdge;
-			neighborhood.push_back(pair<int,int>(NO_COORD(x,y)));
-		}
-	}
+	// check connected pixels, marking them atomically since other threads may reach them too
 
-	#pragma omp critical (NE)
+	for (int i = 0; i < connectivity; i++)
 	{
-		if (NE_INBOUND(gradient,x,y) && !NE(edge_trace,x,y) && NE(gradient,x,y) >= threshold)
-		{
-			NE(edge_trace,x,y) = kEdge;
-			neighborhood.push_back(pair<int,int>(NE_COORD(x,y)));
-		}
-	}
+		if (!InBound(gradient.width(), gradient.height(), x + Neighbors::kX[i], y + Neighbors::kY[i]))
+			continue;
 
-	#pragma omp critical (EA)
-	{
-		if (EA_INBOUND(gradient,x) && !EA(edge_trace,x,y) && EA(gradient,x,y) >= threshold)
-		{
-			EA(edge_trace,x,y) = kEdge;
-			neighborhood.push_back(pair<int,int>(EA_COORD(x,y)));
-		}
-	}
+		const unsigned int kOffset = offset + Neighbors::kX[i] + Neighbors::kY[i]*gradient.width();
 
-	#pragma omp critical (SE)
-	{
-		if (SE_INBOUND(gradient,x,y) && !SE(edge_trace,x,y) && SE(gradient,x,y) >= threshold)
-		{
-			SE(edge_trace,x,y) = kEdge;
-			neighborhood.push_back(pair<int,int>(SE_COORD(x,y)));
-		}
-	}
+		if (kTrace[kOffset] || gradient[kOffset] < threshold)
+			continue;
 
-	#pragma omp critical (SO)
-	{
-		if (SO_INBOUND(gradient, y) && !SO(edge_trace,x,y) && SO(gradient,x,y) >= threshold)
-		{
-			SO(edge_trace,x,y) = kEdge;
-			neighborhood.push_back(pair<int,int>(SO_COORD(x,y)));
-		}
-	}
+		unsigned char previous;
 
-	#pragma omp critical (SW)
-	{
-		if (SW_INBOUND(gradient,x,y) && !SW(edge_trace,x,y) && SW(gradient,x,y) >= threshold)
-		{
-			SW(edge_trace,x,y) = kEdge;
-			neighborhood.push_back(pair<int,int>(SW_COORD(x,y)));
-		}
-	}
+		#pragma omp atomic capture
+		{ previous = kTrace[kOffset]; kTrace[kOffset] = kEdge; }
 
-	#pragma omp critical (WE)
-	{
-		if (WE_INBOUND(x) && !WE(edge_trace,x,y) && WE(gradient,x,y) >= threshold)
-		{
-			WE(edge_trace,x,y) = kEdge;
-			neighborhood.push_back(pair<int,int>(WE_COORD(x,y)));
+		if (!previous)
+			neighborhood.Push(kOffset);
 	}
 }
-}
 
+template<int connectivity>
 CImg<unsigned char> KrabsCanny(const CImg<double>& gray, const float sigma, const double low_threshold, const double high_threshold)
 {
 	// (1) Apply Gaussian filter to smooth the image in order to remove the noise
@@ -239,11 +221,17 @@ CImg<unsigned char> KrabsCanny(const CImg<double>& gray, const float sigma, cons
 	// (4) Apply double threshold to determine potential edges
 	// (5) Track edge by hysteresis: Finalize the detection of edges by suppressing all the other edges that are weak and not connected to strong edges.
 
-	return Hysteresis(grad, high_threshold, low_threshold);
+	return Hysteresis<connectivity>(grad, high_threshold, low_threshold);
 }
 
-inline void Labeling(vector<pair<int, int>> &neighborhood, const CImg<double> &binary, CImg<unsigned int> &labeled, KrabsRegion &region, const int x, const int y, const unsigned int current_label)
+template<int connectivity, typename T, typename L>
+inline void Labeling(KrabsFloodStack &neighborhood, const CImg<T> &binary, CImg<L> &labeled, KrabsRegion &region, const unsigned int offset, const L current_label)
 {
+	typedef Neighborhood<connectivity> Neighbors;
+
+	const int x = offset % binary.width();
+	const int y = offset / binary.width();
+
 	// adjust label region
 
 	region.x0 = x < region.x0 ? x : region.x0;
@@ -251,93 +239,137 @@ inline void Labeling(vector<pair<int, int>> &neighborhood, const CImg<double> &b
 
 	region.y0 = y < region.y0 ? y : region.y0;
 	region.y1 = y > region.y1 ? y : region.y1;
+	region.pixels++;
 
-	// check 8-connected pixels
+	// check connected pixels
 
-	if (NW_INBOUND(x,y) && !NW(labeled,x,y) && NW(binary,x,y))
+	for (int i = 0; i < connectivity; i++)
 	{
-		NW(labeled,x,y) = current_label;
-		neighborhood.push_back(pair<int,int>(NW_COORD(x,y)));
-	}
+		if (!InBound(binary.width(), binary.height(), x + Neighbors::kX[i], y + Neighbors::kY[i]))
+			continue;
 
-	if (NO_INBOUND(y) && !NO(labeled,x,y) && NO(binary,x,y))
-	{
-		NO(labeled,x,y) = current_label;
-		neighborhood.push_back(pair<int,int>(NO_COORD(x,y)));
-	}
+		const unsigned int kOffset = offset + Neighbors::kX[i] + Neighbors::kY[i]*binary.width();
 
-	if (NE_INBOUND(binary,x,y) && !NE(labeled,x,y) && NE(binary,x,y))
-	{
-		NE(labeled,x,y) = current_label;
-		neighborhood.push_back(pair<int,int>(NE_COORD(x,y)));
+		if (!labeled[kOffset] && binary[kOffset])
+		{
+			labeled[kOffset] = current_label;
+			neighborhood.Push(kOffset);
+		}
 	}
+}
 
-	if (EA_INBOUND(binary,x) && !EA(labeled,x,y) && EA(binary,x,y))
-	{
-		EA(labeled,x,y) = current_label;
-		neighborhood.push_back(pair<int,int>(EA_COORD(x,y)));
-	}
+//! Labels the components found from (start_x,start_y) onwards in raster order
+/**
+ * Stops before the first component whose label does not fit in L. Components are only looked for on the pixels
+ * spans include, every pixel when spans is empty.
+ *
+ * \return Linear offset of that component, or binary.width()*binary.height() when every component was labeled
+ */
+template<int connectivity, typename T, typename L>
+static unsigned long LabelComponents(const CImg<T> &binary, CImg<L> &labeled, vector<KrabsRegion> &regions, const int min_area, const unsigned long start,
+	const KrabsSpanMask &spans, unsigned int &current_label)
+{
+	const int kMaxArea = binary.width()*binary.height();
+	const unsigned int kMaxLabel = numeric_limits<L>::max();
+	const int kStartX = start % binary.width();
+	const int kStartY = start / binary.width();
+	const KrabsSpanMask::Span kRow = {0, binary.width()};
 
-	if (SE_INBOUND(binary,x,y) && !SE(labeled,x,y) && SE(binary,x,y))
-	{
-		SE(labeled,x,y) = current_label;
-		neighborhood.push_back(pair<int,int>(SE_COORD(x,y)));
-	}
+	KrabsFloodStack &neighborhood = KrabsThreadFloodStack((unsigned long)kMaxArea);
 
-	if (SO_INBOUND(binary, y) && !SO(labeled,x,y) && SO(binary,x,y))
+	for (int y = kStartY; y < binary.height(); y++)
 	{
-		SO(labeled,x,y) = current_label;
-		neighborhood.push_back(pair<int,int>(SO_COORD(x,y)));
-	}
+		const KrabsSpanMask::Span *const kBegin = spans.is_empty() ? &kRow : spans.begin(y);
+		const KrabsSpanMask::Span *const kEnd = spans.is_empty() ? &kRow + 1 : spans.end(y);
 
-	if (SW_INBOUND(binary,x,y) && !SW(labeled,x,y) && SW(binary,x,y))
-	{
-		SW(labeled,x,y) = current_label;
-		neighborhood.push_back(pair<int,int>(SW_COORD(x,y)));
-	}
+		for (const KrabsSpanMask::Span *span = kBegin; span != kEnd; ++span)
+		{
+			for (int x = (y == kStartY && kStartX > span->x0 ? kStartX : span->x0); x < span->x1; x++)
+			{
+				if (!labeled(x,y) && binary(x,y))
+				{
+					if (current_label == kMaxLabel)
+						return (unsigned long)y*binary.width() + x;
 
-	if (WE_INBOUND(x) && !WE(labeled,x,y) && WE(binary,x,y))
-	{
-		WE(labeled,x,y) = current_label;
-		neighborhood.push_back(pair<int,int>(WE_COORD(x,y)));
+					const L kLabel = static_cast<L>(++current_label);
+					labeled(x,y) = kLabel;
+
+					KrabsRegion region;
+					Labeling<connectivity>(neighborhood, binary, labeled, region, Offset(binary.width(), x, y), kLabel);
+
+					while(!neighborhood.IsEmpty())
+						Labeling<connectivity>(neighborhood, binary, labeled, region, neighborhood.Pop(), kLabel);
+
+					if (region.area() > min_area && region.area() < kMaxArea)
+					{
+						region.label = current_label;
+						regions.push_back(region);
+					}
+				}
+			}
+		}
 	}
+
+	return (unsigned long)kMaxArea;
 }
 
-CImg<unsigned int> KrabsLabeling(const CImg<double> &binary, vector<KrabsRegion> &regions, const int min_area)
+template<int connectivity, typename T>
+CImg<unsigned int> KrabsLabeling(const CImg<T> &binary, vector<KrabsRegion> &regions, const int min_area)
 {
-	const int kMaxArea = binary.width()*binary.height();
-
-	vector<pair<int, int>> neighborhood;
-	CImg<unsigned int> labeled = binary.get_fill(0);
+	CImg<unsigned int> labeled(binary.width(), binary.height(), 1, 1, 0);
 	unsigned int current_label = 0;
 
-	cimg_forXY(binary,x,y)
-	{
-		if (!labeled(x,y) && binary(x,y))
-		{
-			labeled(x,y) = ++current_label;
+	LabelComponents<connectivity>(binary, labeled, regions, min_area, 0, KrabsSpanMask(), current_label);
 
-			KrabsRegion region;
-			Labeling(neighborhood, binary, labeled, region, x, y, current_label);
+	return labeled;
+}
 
-			while(!neighborhood.empty())
-			{
-				pair<int,int> point = neighborhood.back();
-				neighborhood.pop_back();
-				Labeling(neighborhood, binary, labeled, region, point.first, point.second, current_label);
-			}
+template<int connectivity, typename T>
+KrabsLabelImage KrabsCompactLabeling(const CImg<T> &binary, vector<KrabsRegion> &regions, const int min_area)
+{
+	return KrabsCompactLabeling<connectivity>(binary, regions, min_area, KrabsSpanMask());
+}
 
-			if (region.area() > min_area && region.area() < kMaxArea)
-			{
-				region.label = current_label;
-				regions.push_back(region);
-			}
-		}
+template<int connectivity, typename T>
+KrabsLabelImage KrabsCompactLabeling(const CImg<T> &binary, vector<KrabsRegion> &regions, const int min_area, const KrabsSpanMask &spans)
+{
+	const unsigned long kSize = (unsigned long)binary.width()*binary.height();
+
+	KrabsLabelImage labels;
+	unsigned int current_label = 0;
+
+	labels.narrow.assign(binary.width(), binary.height(), 1, 1, 0);
+	const unsigned long kOverflow = LabelComponents<connectivity>(binary, labels.narrow, regions, min_area, 0, spans, current_label);
+
+	if (kOverflow < kSize)
+	{
+		// promote labels to 32 bits and resume from the first component that did not fit
+
+		labels.wide = labels.narrow;
+		labels.narrow.assign();
+		LabelComponents<connectivity>(binary, labels.wide, regions, min_area, kOverflow, spans, current_label);
 	}
 
-	return labeled;
+	return labels;
 }
 
+template CImg<unsigned char> Hysteresis<kFourConnected>(const CImg<double>&, const double, const double);
+template CImg<unsigned char> Hysteresis<kEightConnected>(const CImg<double>&, const double, const double);
+template CImg<unsigned char> KrabsCanny<kFourConnected>(const CImg<double>&, const float, const double, const double);
+template CImg<unsigned char> KrabsCanny<kEightConnected>(const CImg<double>&, const float, const double, const double);
+template CImg<unsigned int> KrabsLabeling<kFourConnected>(const CImg<double>&, vector<KrabsRegion>&, const int);
+template CImg<unsigned int> KrabsLabeling<kEightConnected>(const CImg<double>&, vector<KrabsRegion>&, const int);
+template CImg<unsigned int> KrabsLabeling<kFourConnected>(const CImg<unsigned char>&, vector<KrabsRegion>&, const int);
+template CImg<unsigned int> KrabsLabeling<kEightConnected>(const CImg<unsigned char>&, vector<KrabsRegion>&, const int);
+template KrabsLabelImage KrabsCompactLabeling<kFourConnected>(const CImg<double>&, vector<KrabsRegion>&, const int);
+template KrabsLabelImage KrabsCompactLabeling<kEightConnected>(const CImg<double>&, vector<KrabsRegion>&, const int);
+template KrabsLabelImage KrabsCompactLabeling<kFourConnected>(const CImg<unsigned char>&, vector<KrabsRegion>&, const int);
+template KrabsLabelImage KrabsCompactLabeling<kEightConnected>(const CImg<unsigned char>&, vector<KrabsRegion>&, const int);
+template KrabsLabelImage KrabsCompactLabeling<kFourConnected>(const CImg<double>&, vector<KrabsRegion>&, const int, const KrabsSpanMask&);
+template KrabsLabelImage KrabsCompactLabeling<kEightConnected>(const CImg<double>&, vector<KrabsRegion>&, const int, const KrabsSpanMask&);
+template KrabsLabelImage KrabsCompactLabeling<kFourConnected>(const CImg<unsigned char>&, vector<KrabsRegion>&, const int, const KrabsSpanMask&);
+template KrabsLabelImage KrabsCompactLabeling<kEightConnected>(const CImg<unsigned char>&, vector<KrabsRegion>&, const int, const KrabsSpanMask&);
+
 bool KrabsFindButton(const char* filename, vector<KrabsRegion> regions, const char* button_name, KrabsRegion& button_region, const float zoom_factor)
 {
 	bool button_found = false;
@@ -2,6 +2,7 @@
 #define CIMGTEST_LIB_KRABS_H_
 
 #include "../CImg.h"
+#include "krabs_mask.h"
 #include <climits>
 #include <utility>
 #include <vector>
@@ -19,6 +20,31 @@ const cimg_library::CImg<char> kSobelKernelY(3,3,1,1,{
 const unsigned char kEdge = 255;
 const unsigned char kSupress = 0;
 
+//! Pixel connectivity of the flood fills, chosen at compile time
+const int kFourConnected = 4;
+const int kEightConnected = 8;
+
+//! Stack of linear pixel offsets for the flood fills
+/**
+ * A pixel is marked when pushed, so a fill never holds more than width*height offsets.
+ * The buffer is reserved to that bound up front and kept across calls, hence pushes never reallocate.
+ */
+class KrabsFloodStack
+{
+public:
+	void Reserve(const unsigned long size) { if (size > buffer_.size()) buffer_.resize(size); }
+	void Push(const unsigned int offset) { buffer_[size_++] = offset; }
+	unsigned int Pop() { return buffer_[--size_]; }
+	bool IsEmpty() const { return !size_; }
+
+private:
+	std::vector<unsigned int> buffer_;
+	unsigned long size_ = 0;
+};
+
+//! Flood stack of the calling thread, reserved for images of size pixels
+KrabsFloodStack& KrabsThreadFloodStack(const unsigned long size);
+
 struct KrabsRegion
 {
 	unsigned int label = 0;
@@ -26,10 +52,14 @@ struct KrabsRegion
 	int y0 = INT_MAX;
 	int x1 = INT_MIN;
 	int y1 = INT_MIN;
-
-	int width(){ return x1-x0 > 0 ? x1-x0 : 0; }
-	int height(){ return y1-y0 > 0 ? y1-y0 : 0; }
-	int area(){ return width()*height(); }
+	unsigned int pixels = 0; // set pixels of the component, counted by KrabsLabeling
+	unsigned int track = 0;  // persistent id set by KrabsRegionTracker, 0 when not tracked
+	int dx = 0;              // motion since the previous frame, from KrabsRegionVector
+	int dy = 0;
+
+	int width() const { return x1-x0 > 0 ? x1-x0 : 0; }
+	int height() const { return y1-y0 > 0 ? y1-y0 : 0; }
+	int area() const { return width()*height(); }
 };
 
 //! Sobel edge detection
@@ -42,9 +72,11 @@ inline double ToDegrees(const double radians);
 
 inline double AngleSum(const double angle, const double value);
 
+template<int connectivity = kEightConnected>
 cimg_library::CImg<unsigned char> Hysteresis(const cimg_library::CImg<double> &gradient, const double high_threshold, const double low_threshold);
 
-inline void CheckNeighborhood(std::vector<std::pair<int, int>> &neighborhood, const cimg_library::CImg<double> &gradient, cimg_library::CImg<unsigned char> &edge_trace, const int x, const int y, const double threshold);
+template<int connectivity>
+inline void CheckNeighborhood(KrabsFloodStack &neighborhood, const cimg_library::CImg<double> &gradient, cimg_library::CImg<unsigned char> &edge_trace, const unsigned int offset, const double threshold);
 
 
 //! Canny edge detection
@@ -53,6 +85,7 @@ inline void CheckNeighborhood(std::vector<std::pair<int, int>> &neighborhood, co
  * \param sigma
  * \param low_threshold
  * \param high_threshold
+ * \param connectivity Edge tracing connectivity: kFourConnected or kEightConnected
  *
  * (1) Apply Gaussian filter to smooth the image in order to remove the noise
  * (2) Find the intensity gradients of the image
@@ -62,15 +95,50 @@ inline void CheckNeighborhood(std::vector<std::pair<int, int>> &neighborhood, co
  *
  * Source: https://en.wikipedia.org/wiki/Canny_edge_detector
  */
+template<int connectivity = kEightConnected>
 cimg_library::CImg<unsigned char> KrabsCanny(const cimg_library::CImg<double>& gray, const float sigma, const double low_threshold, const double high_threshold);
 
-inline void Labeling(std::vector<std::pair<int, int>> &neighborhood, const cimg_library::CImg<double> &binary, cimg_library::CImg<unsigned int> &labeled, KrabsRegion &region, const int x, const int y, const unsigned int current_label);
+//! Label image stored with 16-bit labels, promoted to 32-bit labels only when the component count overflows
+struct KrabsLabelImage
+{
+	cimg_library::CImg<unsigned short> narrow;
+	cimg_library::CImg<unsigned int> wide;
+
+	bool is_wide() const { return !wide.is_empty(); }
+	int width() const { return is_wide() ? wide.width() : narrow.width(); }
+	int height() const { return is_wide() ? wide.height() : narrow.height(); }
+	unsigned int operator()(const int x, const int y) const { return is_wide() ? wide(x,y) : narrow(x,y); }
+};
+
+template<int connectivity, typename T, typename L>
+inline void Labeling(KrabsFloodStack &neighborhood, const cimg_library::CImg<T> &binary, cimg_library::CImg<L> &labeled, KrabsRegion &region, const unsigned int offset, const L current_label);
 
 //! Labeling using one component at time approach
 /**
+ * \param connectivity Component connectivity: kFourConnected or kEightConnected
+ * \param binary Binary image, as double or unsigned char
+ *
  * Source: https://en.wikipedia.org/wiki/Connected-component_labeling#One_component_at_a_time
  */
-cimg_library::CImg<unsigned int> KrabsLabeling(const cimg_library::CImg<double> &binary, std::vector<KrabsRegion> &regions, const int min_area);
+template<int connectivity = kEightConnected, typename T = double>
+cimg_library::CImg<unsigned int> KrabsLabeling(const cimg_library::CImg<T> &binary, std::vector<KrabsRegion> &regions, const int min_area);
+
+//! Labeling with compact label storage
+/**
+ * Same as KrabsLabeling, but labels are written as unsigned short while they fit.
+ * When the component count overflows 16 bits, the labels written so far are promoted to
+ * unsigned int and labeling continues from the first component that did not fit.
+ */
+template<int connectivity = kEightConnected, typename T = double>
+KrabsLabelImage KrabsCompactLabeling(const cimg_library::CImg<T> &binary, std::vector<KrabsRegion> &regions, const int min_area);
+
+//! Compact labeling looking for components only on the pixels included in spans
+/**
+ * Rows are scanned along their spans alone. A component is still followed wherever it is set, so binary is
+ * usually cleared outside spans first, and components without any included pixel are not labeled.
+ */
+template<int connectivity = kEightConnected, typename T = double>
+KrabsLabelImage KrabsCompactLabeling(const cimg_library::CImg<T> &binary, std::vector<KrabsRegion> &regions, const int min_area, const KrabsSpanMask &spans);
 
 bool KrabsFindButton(const char* filename, std::vector<KrabsRegion> regions, const char* button_name, KrabsRegion& button_region, const float zoom_factor=1.0f);
 
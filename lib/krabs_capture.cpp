@@ -0,0 +1,303 @@
+#include "krabs_capture.h"
+#include "krabs_convert.h"
+#include "krabs_motion.h"
+
+using namespace cimg_library;
+using namespace std;
+
+// serializes opening and releasing captures, grabbing only takes the camera lock
+static mutex open_mutex;
+
+#ifdef cimg_use_opencv
+//! Next frame of capture after dropping skip_frames, null once it ended
+static const IplImage* QueryFrame(CvCapture* capture, const unsigned int skip_frames)
+{
+	for (unsigned int i = 0; i < skip_frames; i++)
+		cvGrabFrame(capture);
+
+	return cvQueryFrame(capture);
+}
+#endif
+
+bool KrabsFrameSource::GrabGray(CImg<unsigned char>& gray, const unsigned int skip_frames)
+{
+	if (!Grab(color_, skip_frames))
+		return false;
+
+	KrabsLuminance(color_, gray);
+	return true;
+}
+
+KrabsCamera::KrabsCamera(const unsigned int camera_index, const unsigned int width, const unsigned int height) :
+	capture_(0), is_file_(false)
+{
+#ifdef cimg_use_opencv
+	lock_guard<mutex> lock(open_mutex);
+
+	capture_ = cvCreateCameraCapture(camera_index);
+	if (!capture_)
+		throw CImgIOException("KrabsCamera: Failed to initialize camera #%u.", camera_index);
+
+	cvSetCaptureProperty(capture_, CV_CAP_PROP_FRAME_WIDTH, width);
+	cvSetCaptureProperty(capture_, CV_CAP_PROP_FRAME_HEIGHT, height);
+#else
+	cimg::unused(camera_index, width, height);
+	throw CImgIOException("KrabsCamera: Requires the OpenCV library (macro 'cimg_use_opencv' must be defined).");
+#endif
+}
+
+KrabsCamera::KrabsCamera(const char* filename) :
+	capture_(0), is_file_(true)
+{
+#ifdef cimg_use_opencv
+	lock_guard<mutex> lock(open_mutex);
+
+	capture_ = cvCaptureFromFile(filename);
+	if (!capture_)
+		throw CImgIOException("KrabsCamera: Failed to open video file '%s'.", filename);
+#else
+	cimg::unused(filename);
+	throw CImgIOException("KrabsCamera: Requires the OpenCV library (macro 'cimg_use_opencv' must be defined).");
+#endif
+}
+
+KrabsCamera::~KrabsCamera()
+{
+	Release();
+}
+
+bool KrabsCamera::Grab(CImg<double>& frame, const unsigned int skip_frames)
+{
+#ifdef cimg_use_opencv
+	lock_guard<mutex> lock(mutex_);
+
+	if (!capture_)
+		return false;
+
+	const IplImage* kImage = QueryFrame(capture_, skip_frames);
+	if (!kImage)
+		return false;
+
+	KrabsDeinterleave((const unsigned char*)kImage->imageData, kImage->width, kImage->height, kImage->widthStep, kBgrOrder, frame);
+	return true;
+#else
+	cimg::unused(frame, skip_frames);
+	return false;
+#endif
+}
+
+bool KrabsCamera::GrabGray(CImg<unsigned char>& gray, const unsigned int skip_frames)
+{
+#ifdef cimg_use_opencv
+	lock_guard<mutex> lock(mutex_);
+
+	if (!capture_)
+		return false;
+
+	const IplImage* kImage = QueryFrame(capture_, skip_frames);
+	if (!kImage)
+		return false;
+
+	KrabsInterleavedLuminance((const unsigned char*)kImage->imageData, kImage->width, kImage->height, kImage->widthStep, kBgrOrder, gray);
+	return true;
+#else
+	cimg::unused(gray, skip_frames);
+	return false;
+#endif
+}
+
+void KrabsCamera::Release()
+{
+#ifdef cimg_use_opencv
+	lock_guard<mutex> lock(mutex_);
+	lock_guard<mutex> open_lock(open_mutex);
+
+	if (capture_)
+		cvReleaseCapture(&capture_);
+	capture_ = 0;
+#endif
+}
+
+template<typename T>
+void KrabsFrameRing<T>::Assign(const unsigned int width, const unsigned int height, const unsigned int spectrum)
+{
+	for (CImg<T> &slot : slots_)
+		slot.assign(width, height, 1, spectrum);
+}
+
+template<typename T>
+void KrabsFrameRing<T>::Publish()
+{
+	const unsigned int kPrevious = newest_.exchange(back_ | kFresh, memory_order_acq_rel);
+
+	if (kPrevious & kFresh)
+		dropped_.fetch_add(1, memory_order_relaxed);
+	published_.fetch_add(1, memory_order_relaxed);
+
+	back_ = kPrevious & kSlotMask;
+}
+
+template<typename T>
+bool KrabsFrameRing<T>::TakeNewest()
+{
+	// only the consumer clears kFresh, so a fresh frame seen here is still fresh at the exchange
+
+	if (!(newest_.load(memory_order_acquire) & kFresh))
+		return false;
+
+	front_ = newest_.exchange(front_, memory_order_acq_rel) & kSlotMask;
+	return true;
+}
+
+template class KrabsFrameRing<double>;
+template class KrabsFrameRing<unsigned char>;
+
+//! Grabs the next frame of source in the type of frame
+static bool GrabFrame(KrabsFrameSource& source, CImg<double>& frame, const unsigned int skip_frames)
+{
+	return source.Grab(frame, skip_frames);
+}
+
+static bool GrabFrame(KrabsFrameSource& source, CImg<unsigned char>& gray, const unsigned int skip_frames)
+{
+	return source.GrabGray(gray, skip_frames);
+}
+
+KrabsCaptureThread::KrabsCaptureThread(unique_ptr<KrabsFrameSource> source, const unsigned int width, const unsigned int height,
+	const bool gray) :
+	source_(move(source)), gray_(gray), running_(false), finished_(false), failed_(false)
+{
+	if (gray_)
+		gray_ring_.Assign(width, height, 1);
+	else
+		ring_.Assign(width, height, 3);
+}
+
+KrabsCaptureThread::~KrabsCaptureThread()
+{
+	Stop();
+}
+
+void KrabsCaptureThread::Start()
+{
+	if (running_)
+		return;
+
+	running_ = true;
+	thread_ = thread(&KrabsCaptureThread::Run, this);
+}
+
+void KrabsCaptureThread::Stop()
+{
+	{
+		lock_guard<mutex> lock(taken_mutex_);
+		running_ = false;
+	}
+	taken_.notify_one();
+
+	if (thread_.joinable())
+	{
+		thread_.join();
+		source_->Release();
+	}
+}
+
+bool KrabsCaptureThread::TakeNewest(CImg<double>& frame)
+{
+	if (gray_)
+		throw CImgArgumentException("KrabsCaptureThread: Color frame taken from a gray capture thread.");
+
+	return Take(ring_, frame);
+}
+
+bool KrabsCaptureThread::TakeNewest(CImg<unsigned char>& gray)
+{
+	if (!gray_)
+		throw CImgArgumentException("KrabsCaptureThread: Gray frame taken from a color capture thread.");
+
+	return Take(gray_ring_, gray);
+}
+
+template<typename T>
+bool KrabsCaptureThread::Take(KrabsFrameRing<T>& ring, CImg<T>& frame)
+{
+	for (;;)
+	{
+		// read finished_ before the ring, so the last frame published before finishing is still taken
+
+		const bool kFinished = finished_.load(memory_order_acquire);
+
+		if (ring.TakeNewest())
+		{
+			frame = ring.front();
+
+			if (!source_->is_live())
+			{
+				// under the lock, the grabbing thread either checks the ring after the take or is already waiting
+				lock_guard<mutex> lock(taken_mutex_);
+				taken_.notify_one();
+			}
+			return true;
+		}
+
+		if (failed_.load(memory_order_acquire))
+			rethrow_exception(error_);
+
+		if (kFinished)
+			return false;
+
+		unique_lock<mutex> lock(ready_mutex_);
+		ready_.wait(lock, [this, &ring] { return ring.has_newest() || finished_.load(memory_order_acquire); });
+	}
+}
+
+template<typename T>
+void KrabsCaptureThread::Capture(KrabsFrameRing<T>& ring)
+{
+	// the first grab skips a frame, as cameras often return a dark one right after opening
+
+	const bool kLive = source_->is_live();
+	unsigned int skip_frames = kLive ? 1 : 0;
+
+	while (running_ && GrabFrame(*source_, ring.back(), skip_frames))
+	{
+		// the next frame is grabbed while the caller works on this one, then waits until the caller took it
+
+		if (!kLive)
+		{
+			unique_lock<mutex> lock(taken_mutex_);
+			taken_.wait(lock, [this, &ring] { return !running_ || !ring.has_newest(); });
+		}
+
+		// under the lock, the caller either sees the frame or is already waiting for it
+
+		{
+			lock_guard<mutex> lock(ready_mutex_);
+			ring.Publish();
+		}
+		ready_.notify_one();
+		skip_frames = 0;
+	}
+}
+
+void KrabsCaptureThread::Run()
+{
+	try
+	{
+		if (gray_)
+			Capture(gray_ring_);
+		else
+			Capture(ring_);
+	}
+	catch (...)
+	{
+		error_ = current_exception();
+		failed_.store(true, memory_order_release);
+	}
+
+	{
+		lock_guard<mutex> lock(ready_mutex_);
+		finished_.store(true, memory_order_release);
+	}
+	ready_.notify_one();
+}
@@ -0,0 +1,188 @@
+#ifndef CIMGTEST_LIB_KRABS_CAPTURE_H_
+#define CIMGTEST_LIB_KRABS_CAPTURE_H_
+
+#include "../CImg.h"
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+struct CvCapture;
+
+//! Source of frames read one after another: a camera, a recording or a generator
+class KrabsFrameSource
+{
+public:
+	virtual ~KrabsFrameSource() {}
+
+	//! Grabs the next frame as planar RGB, after dropping skip_frames. Returns false once the source ended
+	virtual bool Grab(cimg_library::CImg<double>& frame, const unsigned int skip_frames = 0) = 0;
+
+	//! Grabs the next frame as 8-bit luminance, as KrabsLuminance gives it
+	/**
+	 * Sources reading 8-bit color convert it straight to luminance in one pass. Others grab the color frame and
+	 * convert it, which is what this default does.
+	 */
+	virtual bool GrabGray(cimg_library::CImg<unsigned char>& gray, const unsigned int skip_frames = 0);
+
+	//! Stops reading, later grabs return false
+	virtual void Release() {}
+
+	//! Whether frames arrive at their own pace, like a camera, rather than as soon as they are asked for
+	virtual bool is_live() const = 0;
+
+private:
+	cimg_library::CImg<double> color_; // frame the default GrabGray converts
+};
+
+//! Camera or video file with its own OpenCV capture
+/**
+ * CImg::load_camera keeps every capture in static slots and grabs and converts frames under one global lock, so
+ * cameras read from separate threads wait on each other. KrabsCamera owns its capture and lock instead, and converts
+ * the BGR frame to planar RGB outside any shared lock. Only opening and releasing are serialized between cameras,
+ * as OpenCV capture backends are not safe to open concurrently.
+ */
+class KrabsCamera : public KrabsFrameSource
+{
+public:
+	//! Opens camera camera_index, asking for a width x height resolution
+	KrabsCamera(const unsigned int camera_index, const unsigned int width, const unsigned int height);
+
+	//! Opens a video file, read frame by frame
+	explicit KrabsCamera(const char* filename);
+
+	~KrabsCamera();
+
+	KrabsCamera(const KrabsCamera&) = delete;
+	KrabsCamera& operator=(const KrabsCamera&) = delete;
+
+	bool Grab(cimg_library::CImg<double>& frame, const unsigned int skip_frames = 0);
+	bool GrabGray(cimg_library::CImg<unsigned char>& gray, const unsigned int skip_frames = 0);
+	void Release();
+
+	bool is_live() const { return !is_file_; }
+
+private:
+	CvCapture* capture_;
+	const bool is_file_;
+	std::mutex mutex_;
+};
+
+//! Lock-free single producer, single consumer ring of frame buffers keeping only the newest frame
+/**
+ * Three preallocated buffers rotate between the producer (back), the consumer (front) and the newest
+ * published frame. Publishing and taking are a single atomic exchange each, so neither side ever waits
+ * for the other, and a frame published before the previous one was taken is counted as dropped.
+ *
+ * Frames are planar RGB doubles, or 8-bit luminance. Defined for double and unsigned char.
+ *
+ * Source: https://en.wikipedia.org/wiki/Multiple_buffering#Triple_buffering
+ */
+template<typename T>
+class KrabsFrameRing
+{
+public:
+	KrabsFrameRing() : back_(0), front_(1), newest_(2), published_(0), dropped_(0) {}
+
+	//! Preallocates every buffer, must be called before the producer starts
+	void Assign(const unsigned int width, const unsigned int height, const unsigned int spectrum);
+
+	//! Buffer the producer writes the next frame into
+	cimg_library::CImg<T>& back() { return slots_[back_]; }
+
+	//! Makes the back buffer the newest frame, producer side
+	void Publish();
+
+	//! Moves the newest frame to front(), consumer side. Returns false when nothing was published since the last take
+	bool TakeNewest();
+
+	//! Whether a published frame waits to be taken
+	bool has_newest() const { return (newest_.load(std::memory_order_acquire) & kFresh) != 0; }
+
+	//! Frame taken last, consumer side
+	const cimg_library::CImg<T>& front() const { return slots_[front_]; }
+
+	unsigned long published() const { return published_.load(std::memory_order_relaxed); }
+	unsigned long dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+	static const unsigned int kSlotMask = 3;
+	static const unsigned int kFresh = 4;
+
+	cimg_library::CImg<T> slots_[3];
+	unsigned int back_;
+	unsigned int front_;
+	std::atomic<unsigned int> newest_; // slot index, plus kFresh until taken
+	std::atomic<unsigned long> published_;
+	std::atomic<unsigned long> dropped_;
+};
+
+//! Grabs frames on a dedicated thread
+/**
+ * The capture thread keeps the source busy while the caller processes the previous frame, so
+ * capture latency overlaps with processing and the caller always gets the newest frame.
+ *
+ * A live source drops the frames the caller had no time for. Any other source waits for the caller to take each
+ * frame before publishing the next one, so every frame is processed and runs are reproducible.
+ *
+ * A gray capture thread grabs 8-bit luminance frames with KrabsFrameSource::GrabGray, for callers that never look
+ * at the color, and is taken from with the unsigned char TakeNewest.
+ */
+class KrabsCaptureThread
+{
+public:
+	//! Grabs from source, with buffers preallocated for width x height frames, of 8-bit luminance when gray
+	KrabsCaptureThread(std::unique_ptr<KrabsFrameSource> source, const unsigned int width, const unsigned int height,
+		const bool gray = false);
+
+	~KrabsCaptureThread();
+
+	void Start();
+
+	//! Stops the capture thread and releases the camera
+	void Stop();
+
+	//! Waits for a frame newer than the last one taken and copies it to frame
+	/**
+	 * Returns false once a video file ended and its last frame was taken. Errors raised by the capture thread are
+	 * rethrown here.
+	 */
+	bool TakeNewest(cimg_library::CImg<double>& frame);
+
+	//! Same for a gray capture thread
+	bool TakeNewest(cimg_library::CImg<unsigned char>& gray);
+
+	//! Whether the source is live, see KrabsFrameSource::is_live
+	bool is_live() const { return source_->is_live(); }
+
+	unsigned long captured() const { return gray_ ? gray_ring_.published() : ring_.published(); }
+	unsigned long dropped() const { return gray_ ? gray_ring_.dropped() : ring_.dropped(); }
+	bool is_gray() const { return gray_; }
+
+private:
+	void Run();
+
+	template<typename T>
+	void Capture(KrabsFrameRing<T>& ring);
+
+	template<typename T>
+	bool Take(KrabsFrameRing<T>& ring, cimg_library::CImg<T>& frame);
+
+	std::unique_ptr<KrabsFrameSource> source_;
+	const bool gray_;
+	KrabsFrameRing<double> ring_;
+	KrabsFrameRing<unsigned char> gray_ring_;
+	std::mutex taken_mutex_;             // wakes a source that is not live once its frame was taken
+	std::condition_variable taken_;
+	std::mutex ready_mutex_;             // wakes the caller once a frame is published or the capture ended
+	std::condition_variable ready_;
+	std::thread thread_;
+	std::atomic<bool> running_;
+	std::atomic<bool> finished_;
+	std::atomic<bool> failed_;
+	std::exception_ptr error_;
+};
+
+#endif // CIMGTEST_LIB_KRABS_CAPTURE_H_
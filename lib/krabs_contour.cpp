@@ -0,0 +1,210 @@
+#include "krabs_contour.h"
+
+#include <cmath>
+
+using namespace cimg_library;
+using namespace std;
+
+const int kChainX[8] = { 1, 1, 0,-1,-1,-1, 0, 1};
+const int kChainY[8] = { 0, 1, 1, 1, 0,-1,-1,-1};
+
+const int kMarked = -1;
+
+//! Finds the next contour point clockwise from direction, marking the background pixels visited
+static bool Tracer(const CImg<double> &binary, CImg<int> &labeled, int &x, int &y, int &direction)
+{
+	for (int i = 0; i < 8; i++)
+	{
+		const int kDirection = (direction + i) % 8;
+		const int kX = x + kChainX[kDirection];
+		const int kY = y + kChainY[kDirection];
+
+		if (kX < 0 || kY < 0 || kX >= binary.width() || kY >= binary.height())
+			continue;
+
+		if (binary(kX,kY))
+		{
+			x = kX;
+			y = kY;
+			direction = kDirection;
+			return true;
+		}
+
+		labeled(kX,kY) = kMarked;
+	}
+
+	return false;
+}
+
+static void ContourTracing(const CImg<double> &binary, CImg<int> &labeled, const int x, const int y, const int label, const bool external, KrabsContour *contour)
+{
+	int direction = external ? 7 : 3;
+	int current_x = x;
+	int current_y = y;
+
+	// isolated pixel
+
+	if (!Tracer(binary, labeled, current_x, current_y, direction))
+		return;
+
+	const int kSecondX = current_x;
+	const int kSecondY = current_y;
+
+	for (;;)
+	{
+		labeled(current_x,current_y) = label;
+
+		if (contour)
+		{
+			contour->chain.push_back(static_cast<unsigned char>(direction));
+
+			KrabsRegion &region = contour->region;
+			region.x0 = current_x < region.x0 ? current_x : region.x0;
+			region.x1 = current_x > region.x1 ? current_x : region.x1;
+			region.y1 = current_y > region.y1 ? current_y : region.y1;
+		}
+
+		// search starts two positions clockwise from the previous contour point
+
+		const int kPreviousX = current_x;
+		const int kPreviousY = current_y;
+		direction = (direction + 6) % 8;
+		Tracer(binary, labeled, current_x, current_y, direction);
+
+		if (kPreviousX == x && kPreviousY == y && current_x == kSecondX && current_y == kSecondY)
+			break;
+	}
+}
+
+CImg<int> KrabsContourLabeling(const CImg<double> &binary, vector<KrabsContour> &contours, const int min_area)
+{
+	const int kMaxArea = binary.width()*binary.height();
+
+	CImg<int> labeled(binary.width(), binary.height(), 1, 1, 0);
+	int current_label = 0;
+
+	cimg_forXY(binary,x,y)
+	{
+		if (!binary(x,y))
+			continue;
+
+		int label = labeled(x,y);
+
+		// (1) unlabeled pixel below background: new outer contour
+
+		if (!label && (!y || !binary(x,y-1)))
+		{
+			label = ++current_label;
+			labeled(x,y) = label;
+
+			KrabsContour contour;
+			contour.x = x;
+			contour.y = y;
+			contour.region.x0 = contour.region.x1 = x;
+			contour.region.y0 = contour.region.y1 = y;
+
+			ContourTracing(binary, labeled, x, y, label, true, &contour);
+
+			if (contour.region.area() > min_area && contour.region.area() < kMaxArea)
+			{
+				contour.region.label = label;
+				contours.push_back(contour);
+			}
+		}
+
+		// (2) pixel above unmarked background: new inner contour
+
+		if (y < binary.height()-1 && !binary(x,y+1) && !labeled(x,y+1))
+		{
+			if (!label)
+				label = labeled(x,y) = x ? labeled(x-1,y) : 0;
+
+			ContourTracing(binary, labeled, x, y, label, false, nullptr);
+		}
+
+		// (3) interior pixel: take the label of the left neighbor
+
+		else if (!label && x)
+			labeled(x,y) = labeled(x-1,y);
+	}
+
+	return labeled.max(0);
+}
+
+//! Iterative Douglas-Peucker over vertices[first..last]
+static void Simplify(const vector<pair<int, int>> &vertices, vector<bool> &keep, const double tolerance)
+{
+	vector<pair<int, int>> ranges(1, pair<int,int>(0, (int)vertices.size()-1));
+
+	while(!ranges.empty())
+	{
+		pair<int,int> range = ranges.back();
+		ranges.pop_back();
+
+		const pair<int,int> &kFirst = vertices[range.first];
+		const pair<int,int> &kLast  = vertices[range.second];
+		const double kDx = kLast.first - kFirst.first;
+		const double kDy = kLast.second - kFirst.second;
+		const double kLength = sqrt(kDx*kDx + kDy*kDy);
+
+		double max_distance = 0;
+		int farthest = -1;
+
+		for (int i = range.first + 1; i < range.second; i++)
+		{
+			const double kPx = vertices[i].first - kFirst.first;
+			const double kPy = vertices[i].second - kFirst.second;
+			const double kDistance = kLength > 0 ? fabs(kPx*kDy - kPy*kDx)/kLength : sqrt(kPx*kPx + kPy*kPy);
+
+			if (kDistance > max_distance)
+			{
+				max_distance = kDistance;
+				farthest = i;
+			}
+		}
+
+		if (farthest >= 0 && max_distance > tolerance)
+		{
+			keep[farthest] = true;
+			ranges.push_back(pair<int,int>(range.first, farthest));
+			ranges.push_back(pair<int,int>(farthest, range.second));
+		}
+	}
+}
+
+vector<pair<int, int>> KrabsContourPolygon(const KrabsContour &contour, const double tolerance)
+{
+	vector<pair<int, int>> vertices(1, pair<int,int>(contour.x, contour.y));
+
+	// keep the points where the chain code changes direction
+
+	int x = contour.x;
+	int y = contour.y;
+	const size_t kSize = contour.chain.size();
+
+	for (size_t i = 0; i < kSize; i++)
+	{
+		x += kChainX[contour.chain[i]];
+		y += kChainY[contour.chain[i]];
+
+		if (i + 1 < kSize && contour.chain[i+1] != contour.chain[i])
+			vertices.push_back(pair<int,int>(x, y));
+	}
+
+	if (tolerance <= 0 || vertices.size() < 3)
+		return vertices;
+
+	// close the polygon for simplification and drop the duplicated start point afterwards
+
+	vertices.push_back(vertices.front());
+	vector<bool> keep(vertices.size(), false);
+	keep.front() = keep.back() = true;
+	Simplify(vertices, keep, tolerance);
+
+	vector<pair<int, int>> polygon;
+	for (size_t i = 0; i + 1 < vertices.size(); i++)
+		if (keep[i])
+			polygon.push_back(vertices[i]);
+
+	return polygon;
+}
@@ -0,0 +1,39 @@
+#ifndef CIMGTEST_LIB_KRABS_CONTOUR_H_
+#define CIMGTEST_LIB_KRABS_CONTOUR_H_
+
+#include "krabs.h"
+#include <utility>
+#include <vector>
+
+//! Outer contour of a component as a Freeman chain code
+/**
+ * Directions are 0 - east, 1 - south east, 2 - south, ..., 7 - north east (clockwise, y grows downwards).
+ * The chain starts and ends at (x,y), the top-left pixel of the component.
+ */
+struct KrabsContour
+{
+	KrabsRegion region;
+	int x = 0;
+	int y = 0;
+	std::vector<unsigned char> chain;
+};
+
+//! Labeling using contour tracing approach
+/**
+ * Single raster scan that traces the outer and inner contours of each component when it meets them
+ * and propagates labels from the left neighbor elsewhere, so interior pixels are visited once.
+ * Outer contours of the components that pass the area filter are appended to contours.
+ *
+ * Source: F. Chang, C.-J. Chen, C.-J. Lu, "A linear-time component-labeling algorithm using contour tracing technique", 2004
+ */
+cimg_library::CImg<int> KrabsContourLabeling(const cimg_library::CImg<double> &binary, std::vector<KrabsContour> &contours, const int min_area);
+
+//! Polygon vertices of a contour
+/**
+ * \param contour Contour traced by KrabsContourLabeling
+ * \param tolerance Maximum distance, in pixels, from a dropped vertex to the polygon (Douglas-Peucker). Zero keeps
+ * every change of direction of the chain code.
+ */
+std::vector<std::pair<int, int>> KrabsContourPolygon(const KrabsContour &contour, const double tolerance=0);
+
+#endif // CIMGTEST_LIB_KRABS_CONTOUR_H_
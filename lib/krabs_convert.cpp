@@ -0,0 +1,74 @@
+#include "krabs_convert.h"
+
+using namespace cimg_library;
+using namespace std;
+
+const long kParallelPixels = 65536;
+
+// the build targets baseline x86-64, where the stride-3 byte loads of the row kernels do not vectorize: gcc compiles
+// them again for SSSE3 and AVX2 and picks the version the CPU runs once, when the program is loaded
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+#define KRABS_SIMD_CLONES __attribute__((target_clones("avx2","ssse3","default")))
+#else
+#define KRABS_SIMD_CLONES
+#endif
+
+//! Luminance of a row of interleaved pixels, first and last weights following the channel order
+KRABS_SIMD_CLONES
+static void LuminanceRow(const unsigned char *__restrict row, const int width, const int first_weight, const int last_weight,
+	unsigned char *__restrict gray)
+{
+	#pragma omp simd
+	for (int x = 0; x < width; x++)
+		gray[x] = (unsigned char)((first_weight*row[3*x] + 150*row[3*x + 1] + last_weight*row[3*x + 2] + 128) >> 8);
+}
+
+//! Splits a row of interleaved pixels into the planes of its first, second and last channels
+template<typename T>
+KRABS_SIMD_CLONES
+static void DeinterleaveRow(const unsigned char *__restrict row, const int width, T *__restrict first, T *__restrict second,
+	T *__restrict last)
+{
+	#pragma omp simd
+	for (int x = 0; x < width; x++)
+	{
+		first[x] = (T)row[3*x];
+		second[x] = (T)row[3*x + 1];
+		last[x] = (T)row[3*x + 2];
+	}
+}
+
+void KrabsInterleavedLuminance(const unsigned char* pixels, const int width, const int height, const long stride,
+	const KrabsChannelOrder order, CImg<unsigned char>& gray)
+{
+	gray.assign(width, height);
+
+	// weights follow the channel order, so the row loop reads the pixel bytes in place
+
+	const int kFirst = order == kBgrOrder ? 29 : 77;
+	const int kLast = order == kBgrOrder ? 77 : 29;
+
+	#pragma omp parallel for schedule(static) if ((long)width*height >= kParallelPixels)
+	for (int y = 0; y < height; y++)
+		LuminanceRow(pixels + y*stride, width, kFirst, kLast, gray.data(0,y));
+}
+
+template<typename T>
+void KrabsDeinterleave(const unsigned char* pixels, const int width, const int height, const long stride,
+	const KrabsChannelOrder order, CImg<T>& planar)
+{
+	planar.assign(width, height, 1, 3);
+
+	// the first and last bytes of a pixel go to the red or blue plane, so every plane is written from a fixed offset
+
+	const int kFirstPlane = order == kBgrOrder ? 2 : 0;
+	const int kLastPlane = 2 - kFirstPlane;
+
+	#pragma omp parallel for schedule(static) if ((long)width*height >= kParallelPixels)
+	for (int y = 0; y < height; y++)
+		DeinterleaveRow(pixels + y*stride, width, planar.data(0,y,0,kFirstPlane), planar.data(0,y,0,1), planar.data(0,y,0,kLastPlane));
+}
+
+template void KrabsDeinterleave(const unsigned char*, const int, const int, const long, const KrabsChannelOrder, CImg<unsigned char>&);
+template void KrabsDeinterleave(const unsigned char*, const int, const int, const long, const KrabsChannelOrder, CImg<float>&);
+template void KrabsDeinterleave(const unsigned char*, const int, const int, const long, const KrabsChannelOrder, CImg<double>&);
@@ -0,0 +1,37 @@
+#ifndef CIMGTEST_LIB_KRABS_CONVERT_H_
+#define CIMGTEST_LIB_KRABS_CONVERT_H_
+
+#include "../CImg.h"
+
+//! Channel order of interleaved 8-bit pixels
+enum KrabsChannelOrder { kRgbOrder, kBgrOrder };
+
+//! 8-bit luminance of interleaved 8-bit color pixels, in one pass
+/**
+ * gray = (77*R + 150*G + 29*B + 128) >> 8, the weights of KrabsLuminance, so both give the same gray for the same
+ * frame. Rows are vectorized with AVX2 or SSSE3 as the CPU has them, picked at load time, and converted in
+ * parallel for large frames.
+ *
+ * \param pixels First row, 3 bytes per pixel
+ * \param stride Bytes from the start of a row to the start of the next, at least 3*width
+ * \param order Order of the channels in each pixel, such as kBgrOrder for OpenCV frames
+ */
+void KrabsInterleavedLuminance(const unsigned char* pixels, const int width, const int height, const long stride,
+	const KrabsChannelOrder order, cimg_library::CImg<unsigned char>& gray);
+
+//! Planar RGB of interleaved 8-bit color pixels
+/**
+ * Reads camera buffers, raw video and pipes alike: one pass over the bytes, writing the three planes of a
+ * width x height x 1 x 3 image in RGB order whatever the order of the input. Rows are vectorized with AVX2 or SSSE3
+ * as the CPU has them, picked at load time, and converted in parallel for large frames. Defined for unsigned char,
+ * float and double.
+ *
+ * \param pixels First row, 3 bytes per pixel
+ * \param stride Bytes from the start of a row to the start of the next, at least 3*width
+ * \param order Order of the channels in each pixel
+ */
+template<typename T>
+void KrabsDeinterleave(const unsigned char* pixels, const int width, const int height, const long stride,
+	const KrabsChannelOrder order, cimg_library::CImg<T>& planar);
+
+#endif // CIMGTEST_LIB_KRABS_CONVERT_H_
@@ -0,0 +1,99 @@
+#include "krabs_events.h"
+
+#include <chrono>
+#include <cstring>
+
+using namespace cimg_library;
+using namespace std;
+
+const size_t kFlushSize = 64*1024;
+const int kFlushMilliseconds = 500;
+
+KrabsEventWriter::KrabsEventWriter(const char* filename) :
+	file_(stdout), owns_file_(false), closing_(false)
+{
+	if (filename && strlen(filename))
+	{
+		file_ = cimg::fopen(filename, "ab");
+		owns_file_ = true;
+	}
+
+	pending_.reserve(kFlushSize);
+	thread_ = thread(&KrabsEventWriter::Run, this);
+}
+
+KrabsEventWriter::~KrabsEventWriter()
+{
+	{
+		lock_guard<mutex> lock(mutex_);
+		closing_ = true;
+	}
+	wake_.notify_one();
+	thread_.join();
+
+	if (owns_file_)
+		cimg::fclose(file_);
+}
+
+long long KrabsEventWriter::Now()
+{
+	return chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void KrabsEventWriter::WriteMotion(const long long timestamp, const int camera, const unsigned long frame, const vector<KrabsRegion> &regions)
+{
+	// format outside the lock, the writer thread only waits for the append
+
+	char buffer[192];
+	unsigned long pixels = 0;
+	string regions_json;
+
+	for (const KrabsRegion &region : regions)
+	{
+		snprintf(buffer, sizeof(buffer), "%s{\"track\":%u,\"x0\":%d,\"y0\":%d,\"x1\":%d,\"y1\":%d,\"pixels\":%u,\"dx\":%d,\"dy\":%d}",
+			regions_json.empty() ? "" : ",", region.track, region.x0, region.y0, region.x1, region.y1, region.pixels, region.dx, region.dy);
+		regions_json += buffer;
+		pixels += region.pixels;
+	}
+
+	snprintf(buffer, sizeof(buffer), "{\"timestamp\":%lld,\"camera\":%d,\"frame\":%lu,\"pixels\":%lu,\"regions\":[", timestamp, camera, frame, pixels);
+
+	bool flush;
+	{
+		lock_guard<mutex> lock(mutex_);
+		pending_ += buffer;
+		pending_ += regions_json;
+		pending_ += "]}\n";
+		flush = pending_.size() >= kFlushSize;
+	}
+
+	if (flush)
+		wake_.notify_one();
+}
+
+void KrabsEventWriter::Run()
+{
+	string writing;
+	writing.reserve(kFlushSize);
+
+	unique_lock<mutex> lock(mutex_);
+	for (;;)
+	{
+		wake_.wait_for(lock, chrono::milliseconds(kFlushMilliseconds), [this] { return closing_ || pending_.size() >= kFlushSize; });
+
+		const bool kClosing = closing_;
+		writing.swap(pending_);
+		lock.unlock();
+
+		if (!writing.empty())
+		{
+			fwrite(writing.data(), 1, writing.size(), file_);
+			fflush(file_);
+			writing.clear();
+		}
+
+		if (kClosing)
+			return;
+		lock.lock();
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef CIMGTEST_LIB_KRABS_EVENTS_H_
+#define CIMGTEST_LIB_KRABS_EVENTS_H_
+
+#include "krabs.h"
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//! Writes motion events as newline delimited JSON
+/**
+ * One line per frame with motion:
+ * {"timestamp":1477000000000,"camera":0,"frame":12,"pixels":5230,"regions":[{"track":3,"x0":10,"y0":20,"x1":110,"y1":90,"pixels":5230,"dx":4,"dy":0}]}
+ * with the timestamp in milliseconds since the epoch, camera telling apart cameras sharing the writer, track the
+ * region persistent id, 0 when regions are not tracked, and dx, dy the region motion since the previous frame.
+ *
+ * Lines are appended to a memory buffer, and a writer thread swaps it out and writes it to the file,
+ * so the caller never waits on I/O.
+ *
+ * Source: http://ndjson.org
+ */
+class KrabsEventWriter
+{
+public:
+	//! Writes to filename, or to stdout when filename is empty
+	explicit KrabsEventWriter(const char* filename);
+
+	//! Writes the pending lines and closes the file
+	~KrabsEventWriter();
+
+	//! Appends one line, may be called from several threads
+	void WriteMotion(const long long timestamp, const int camera, const unsigned long frame, const std::vector<KrabsRegion> &regions);
+
+	//! Milliseconds since the epoch
+	static long long Now();
+
+private:
+	void Run();
+
+	FILE* file_;
+	bool owns_file_;
+	bool closing_;
+	std::string pending_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::thread thread_;
+};
+
+#endif // CIMGTEST_LIB_KRABS_EVENTS_H_
@@ -0,0 +1,262 @@
+#include "krabs_flow.h"
+
+#include <algorithm>
+
+using namespace cimg_library;
+using namespace std;
+
+// blocks differing in place by less than this on average are taken as still
+const double kStillDifference = 1.0;
+
+// regions with fewer blocks are matched on the calling thread
+const int kParallelBlocks = 16;
+
+// large diamond around its center, then small diamond
+const int kLargeDiamond[8][2] = {{0,-2},{1,-1},{2,0},{1,1},{0,2},{-1,1},{-2,0},{-1,-1}};
+const int kSmallDiamond[4][2] = {{0,-1},{1,0},{0,1},{-1,0}};
+
+//! Type absolute differences of T are summed in
+template<typename T> struct Sad { typedef double type; };
+template<> struct Sad<unsigned char> { typedef int type; };
+
+//! Sum of absolute differences between the width x height blocks at (x0,y0) on a and (x1,y1) on b
+template<typename T>
+static typename Sad<T>::type BlockSad(const CImg<T> &a, const int x0, const int y0, const CImg<T> &b, const int x1, const int y1,
+	const int width, const int height)
+{
+	typedef typename Sad<T>::type S;
+
+	S sum = 0;
+	for (int y = 0; y < height; y++)
+	{
+		const T *const kRowA = a.data(x0, y0 + y);
+		const T *const kRowB = b.data(x1, y1 + y);
+
+		#pragma omp simd reduction(+:sum)
+		for (int x = 0; x < width; x++)
+		{
+			const S kDifference = (S)kRowA[x] - (S)kRowB[x];
+			sum += kDifference >= 0 ? kDifference : -kDifference;
+		}
+	}
+
+	return sum;
+}
+
+//! Offsets (dx, dy) the block at match.x, match.y can be searched at, so the previous frame holds it
+struct SearchWindow
+{
+	SearchWindow(const int previous_width, const int previous_height, const int width, const int height, const int range, const KrabsMotionVector &match) :
+		min_dx(max(-range, match.x + width - previous_width)), max_dx(min(range, match.x)),
+		min_dy(max(-range, match.y + height - previous_height)), max_dy(min(range, match.y)) {}
+
+	bool Contains(const int dx, const int dy) const { return dx >= min_dx && dx <= max_dx && dy >= min_dy && dy <= max_dy; }
+
+	const int min_dx;
+	const int max_dx;
+	const int min_dy;
+	const int max_dy;
+};
+
+//! Diamond search starting from match.dx, match.dy whose SAD is best, updating dx, dy and sad
+template<typename T>
+static void DiamondSearch(const CImg<T> &previous, const CImg<T> &current, const int width, const int height, const SearchWindow &window,
+	typename Sad<T>::type best, KrabsMotionVector &match)
+{
+	typedef typename Sad<T>::type S;
+
+	// the block is searched at (x - dx, y - dy) on the previous frame
+
+	const auto kTry = [&](const int dx, const int dy, int &best_dx, int &best_dy) {
+		if (!window.Contains(dx, dy))
+			return;
+
+		const S kSad = BlockSad(current, match.x, match.y, previous, match.x - dx, match.y - dy, width, height);
+		if (kSad < best)
+		{
+			best = kSad;
+			best_dx = dx;
+			best_dy = dy;
+		}
+	};
+
+	// each large step lowers the SAD, so it ends, and the window bounds it by its area
+
+	for (;;)
+	{
+		int best_dx = match.dx, best_dy = match.dy;
+		for (const int *kPoint : kLargeDiamond)
+			kTry(match.dx + kPoint[0], match.dy + kPoint[1], best_dx, best_dy);
+
+		if (best_dx == match.dx && best_dy == match.dy)
+			break;
+
+		match.dx = best_dx;
+		match.dy = best_dy;
+	}
+
+	int best_dx = match.dx, best_dy = match.dy;
+	for (const int *kPoint : kSmallDiamond)
+		kTry(match.dx + kPoint[0], match.dy + kPoint[1], best_dx, best_dy);
+
+	match.dx = best_dx;
+	match.dy = best_dy;
+	match.sad = (double)best;
+}
+
+//! Most common vector among the vectors that moved, (0,0) when none did
+/**
+ * Blocks straddling an object border match anywhere along the flat background, so their vectors scatter and pull
+ * a median away, while the blocks inside the object agree on one vector.
+ */
+static void CommonVector(const vector<KrabsMotionVector>::const_iterator first, const vector<KrabsMotionVector>::const_iterator last, int &dx, int &dy)
+{
+	vector<pair<int,int>> moved;
+	for (vector<KrabsMotionVector>::const_iterator motion = first; motion != last; ++motion)
+		if (motion->dx || motion->dy)
+			moved.push_back(make_pair(motion->dx, motion->dy));
+
+	sort(moved.begin(), moved.end());
+
+	dx = dy = 0;
+	size_t best_count = 0;
+	for (size_t i = 0; i < moved.size();)
+	{
+		size_t j = i + 1;
+		while (j < moved.size() && moved[j] == moved[i])
+			j++;
+
+		if (j - i > best_count)
+		{
+			best_count = j - i;
+			dx = moved[i].first;
+			dy = moved[i].second;
+		}
+		i = j;
+	}
+}
+
+template<typename T>
+void KrabsBlockVectors(const CImg<T> &previous, const CImg<T> &current, const KrabsRegion &region,
+	const int block, const int range, vector<KrabsMotionVector> &vectors)
+{
+	typedef typename Sad<T>::type S;
+
+	const int kX0 = max(region.x0, 0);
+	const int kY0 = max(region.y0, 0);
+	const int kX1 = min(region.x1 + 1, min(current.width(), previous.width()));
+	const int kY1 = min(region.y1 + 1, min(current.height(), previous.height()));
+
+	if (kX0 >= kX1 || kY0 >= kY1 || block <= 0)
+		return;
+
+	const int kBlocksX = (kX1 - kX0 + block - 1)/block;
+	const int kBlocks = kBlocksX*((kY1 - kY0 + block - 1)/block);
+	const size_t kFirst = vectors.size();
+	vectors.resize(kFirst + kBlocks);
+
+	// search around no motion, skipping the blocks that match in place
+
+	#pragma omp parallel for schedule(dynamic) if (kBlocks >= kParallelBlocks)
+	for (int i = 0; i < kBlocks; i++)
+	{
+		KrabsMotionVector &match = vectors[kFirst + i];
+		match.x = kX0 + (i%kBlocksX)*block;
+		match.y = kY0 + (i/kBlocksX)*block;
+
+		const int kWidth = min(block, kX1 - match.x);
+		const int kHeight = min(block, kY1 - match.y);
+		const S kStill = BlockSad(current, match.x, match.y, previous, match.x, match.y, kWidth, kHeight);
+
+		match.sad = (double)kStill;
+		if (kStill <= kStillDifference*kWidth*kHeight)
+			continue;
+
+		// probes at half the range, as in the first step of a three step search, keep large moves
+		// from ending in a minimum next to no motion
+
+		const SearchWindow kWindow(previous.width(), previous.height(), kWidth, kHeight, range, match);
+		const int kProbe = range/2;
+		S best = kStill;
+
+		for (const int *kPoint : kLargeDiamond)
+		{
+			const int kDx = kPoint[0]*kProbe/2;
+			const int kDy = kPoint[1]*kProbe/2;
+			if ((kDx || kDy) && kWindow.Contains(kDx, kDy))
+			{
+				const S kSad = BlockSad(current, match.x, match.y, previous, match.x - kDx, match.y - kDy, kWidth, kHeight);
+				if (kSad < best)
+				{
+					best = kSad;
+					match.dx = kDx;
+					match.dy = kDy;
+				}
+			}
+		}
+
+		if (best < kStill)
+		{
+			// the probe is only a start, the diamond from no motion may still end lower
+			KrabsMotionVector from_still = match;
+			from_still.dx = from_still.dy = 0;
+			DiamondSearch(previous, current, kWidth, kHeight, kWindow, kStill, from_still);
+			DiamondSearch(previous, current, kWidth, kHeight, kWindow, best, match);
+			if (from_still.sad < match.sad)
+				match = from_still;
+		}
+		else
+			DiamondSearch(previous, current, kWidth, kHeight, kWindow, kStill, match);
+	}
+
+	// blocks of one object share its motion: the most common vector of the region is a second start, which
+	// recovers blocks whose search ended in a local minimum
+
+	int common_dx, common_dy;
+	CommonVector(vectors.begin() + kFirst, vectors.end(), common_dx, common_dy);
+	if (!common_dx && !common_dy)
+		return;
+
+	#pragma omp parallel for schedule(dynamic) if (kBlocks >= kParallelBlocks)
+	for (int i = 0; i < kBlocks; i++)
+	{
+		KrabsMotionVector &match = vectors[kFirst + i];
+		const int kWidth = min(block, kX1 - match.x);
+		const int kHeight = min(block, kY1 - match.y);
+		const SearchWindow kWindow(previous.width(), previous.height(), kWidth, kHeight, range, match);
+
+		if ((match.dx == common_dx && match.dy == common_dy) || match.sad <= kStillDifference*kWidth*kHeight || !kWindow.Contains(common_dx, common_dy))
+			continue;
+
+		const S kCommon = BlockSad(current, match.x, match.y, previous, match.x - common_dx, match.y - common_dy, kWidth, kHeight);
+		if (kCommon < match.sad)
+		{
+			match.dx = common_dx;
+			match.dy = common_dy;
+			DiamondSearch(previous, current, kWidth, kHeight, kWindow, kCommon, match);
+		}
+	}
+}
+
+template<typename T>
+KrabsMotionVector KrabsRegionVector(const CImg<T> &previous, const CImg<T> &current, const KrabsRegion &region,
+	const int block, const int range)
+{
+	vector<KrabsMotionVector> vectors;
+	KrabsBlockVectors(previous, current, region, block, range, vectors);
+
+	KrabsMotionVector motion;
+	motion.x = region.x0;
+	motion.y = region.y0;
+	CommonVector(vectors.begin(), vectors.end(), motion.dx, motion.dy);
+
+	for (const KrabsMotionVector &kVector : vectors)
+		motion.sad += kVector.sad;
+
+	return motion;
+}
+
+template void KrabsBlockVectors<double>(const CImg<double>&, const CImg<double>&, const KrabsRegion&, const int, const int, vector<KrabsMotionVector>&);
+template void KrabsBlockVectors<unsigned char>(const CImg<unsigned char>&, const CImg<unsigned char>&, const KrabsRegion&, const int, const int, vector<KrabsMotionVector>&);
+template KrabsMotionVector KrabsRegionVector<double>(const CImg<double>&, const CImg<double>&, const KrabsRegion&, const int, const int);
+template KrabsMotionVector KrabsRegionVector<unsigned char>(const CImg<unsigned char>&, const CImg<unsigned char>&, const KrabsRegion&, const int, const int);
@@ -0,0 +1,49 @@
+#ifndef CIMGTEST_LIB_KRABS_FLOW_H_
+#define CIMGTEST_LIB_KRABS_FLOW_H_
+
+#include "krabs.h"
+#include <vector>
+
+//! Displacement of a block between the previous and the current frame
+struct KrabsMotionVector
+{
+	int x = 0;  // block top left corner on the current frame
+	int y = 0;
+	int dx = 0; // the block was at (x - dx, y - dy) on the previous frame
+	int dy = 0;
+	double sad = 0; // sum of absolute differences at the match
+};
+
+//! Block matching motion vectors inside a region
+/**
+ * The region box is split into block x block blocks, and each one is searched for on the previous frame within
+ * range pixels, with a diamond search: the large diamond moves to its best point until its center is the best,
+ * then the small diamond refines it. The search starts from no motion and from the best of eight probes at half
+ * the range, then blocks are searched again from the most common vector of the region when it matches them better.
+ * A block that already matches where it stands is not searched, so the cost follows the moving area.
+ *
+ * The sums of absolute differences are vectorized along block rows, and blocks are matched in parallel.
+ *
+ * \param previous Previous gray frame
+ * \param current Current gray frame, of the same size
+ * \param region Region on the current frame, usually a motion region
+ * \param block Block side, blocks are clipped to the region and the frame
+ * \param range Largest displacement searched along each axis
+ * \param vectors Appended one vector per block
+ *
+ * Source: S. Zhu, K.-K. Ma, "A new diamond search algorithm for fast block-matching motion estimation", 2000
+ */
+template<typename T>
+void KrabsBlockVectors(const cimg_library::CImg<T> &previous, const cimg_library::CImg<T> &current, const KrabsRegion &region,
+	const int block, const int range, std::vector<KrabsMotionVector> &vectors);
+
+//! Motion of a whole region: the most common of its block vectors that moved, or no motion when none did
+/**
+ * Blocks of the region box lying on the still background match in place, so they are left out.
+ * The returned vector is placed at the region x0, y0, with the sum of the block SADs.
+ */
+template<typename T>
+KrabsMotionVector KrabsRegionVector(const cimg_library::CImg<T> &previous, const cimg_library::CImg<T> &current, const KrabsRegion &region,
+	const int block, const int range);
+
+#endif // CIMGTEST_LIB_KRABS_FLOW_H_
@@ -0,0 +1,89 @@
+#include "krabs_heatmap.h"
+
+#include <cmath>
+#include <cstdio>
+
+using namespace cimg_library;
+using namespace std;
+
+template<typename T>
+void KrabsHeatmap::Add(const CImg<T> &mask)
+{
+	const int kWidth = mask.width();
+	const int kHeight = mask.height();
+	const int kCell = cell_;
+	const int kCellsX = (kWidth + kCell - 1)/kCell;
+	const int kCellsY = (kHeight + kCell - 1)/kCell;
+
+	if (counts_.is_empty())
+		counts_.assign(kCellsX, kCellsY, 1, 1, 0);
+	else if (counts_.width() != kCellsX || counts_.height() != kCellsY)
+		throw CImgArgumentException("KrabsHeatmap: Mask size %dx%d differs from the heatmap size %dx%d.",
+			kWidth, kHeight, counts_.width()*kCell, counts_.height()*kCell);
+
+	#pragma omp parallel if (kHeight >= 4*kCell)
+	{
+		CImg<unsigned int> columns(kWidth);
+		unsigned int *const kColumns = columns.data();
+
+		#pragma omp for schedule(static)
+		for (int cy = 0; cy < kCellsY; cy++)
+		{
+			const int kY1 = (cy + 1)*kCell < kHeight ? (cy + 1)*kCell : kHeight;
+
+			#pragma omp simd
+			for (int x = 0; x < kWidth; x++)
+				kColumns[x] = 0;
+
+			for (int y = cy*kCell; y < kY1; y++)
+			{
+				const T *const kMask = mask.data(0,y);
+
+				#pragma omp simd
+				for (int x = 0; x < kWidth; x++)
+					kColumns[x] += kMask[x] ? 1 : 0;
+			}
+
+			unsigned int *const kCounts = counts_.data(0,cy);
+			for (int cx = 0; cx < kCellsX; cx++)
+			{
+				const int kX1 = (cx + 1)*kCell < kWidth ? (cx + 1)*kCell : kWidth;
+				unsigned int sum = 0;
+
+				for (int x = cx*kCell; x < kX1; x++)
+					sum += kColumns[x];
+				kCounts[cx] += sum;
+			}
+		}
+	}
+
+	frames_++;
+}
+
+void KrabsHeatmap::SavePng(const char* filename) const
+{
+	if (counts_.is_empty())
+		return;
+
+	const double kScale = 255/log1p((double)counts_.max());
+	CImg<unsigned char> levels(counts_.width(), counts_.height());
+
+	cimg_forXY(levels,x,y)
+		levels(x,y) = (unsigned char)(counts_(x,y) ? log1p((double)counts_(x,y))*kScale + 0.5 : 0);
+
+	levels.get_map(CImg<unsigned char>::jet_LUT256()).save_png(filename);
+}
+
+void KrabsHeatmap::SaveCsv(const char* filename) const
+{
+	FILE *const kFile = cimg::fopen(filename, "w");
+
+	for (int y = 0; y < counts_.height(); y++)
+		for (int x = 0; x < counts_.width(); x++)
+			fprintf(kFile, "%u%c", counts_(x,y), x + 1 < counts_.width() ? ',' : '\n');
+
+	cimg::fclose(kFile);
+}
+
+template void KrabsHeatmap::Add(const CImg<double>&);
+template void KrabsHeatmap::Add(const CImg<unsigned char>&);
@@ -0,0 +1,43 @@
+#ifndef CIMGTEST_LIB_KRABS_HEATMAP_H_
+#define CIMGTEST_LIB_KRABS_HEATMAP_H_
+
+#include "../CImg.h"
+
+//! Motion accumulated over a long time on a grid of cells
+/**
+ * Each cell counts the motion pixels seen in its cell x cell pixels, summed over every frame added, so the grid is
+ * the frame decimated by cell and the cost of a frame does not depend on how long it has been running. Counts are
+ * 32-bit: at most cell*cell per frame, so cells of 8 pixels last 2^26 frames, over three weeks at 30 fps.
+ *
+ * Frames are summed down the columns of each row of cells with vectorized adds, then across each cell, rows of
+ * cells in parallel.
+ */
+class KrabsHeatmap
+{
+public:
+	explicit KrabsHeatmap(const int cell) : cell_(cell > 1 ? cell : 1), frames_(0) {}
+
+	//! Adds a 0/1 motion mask, of the size of the first mask added. Defined for double and unsigned char
+	template<typename T>
+	void Add(const cimg_library::CImg<T> &mask);
+
+	//! Counts a frame without motion, skipping the pass over its empty mask
+	void AddStatic() { frames_++; }
+
+	//! Saves the grid as a PNG image, with counts on a logarithmic jet color scale from zero to the highest count
+	void SavePng(const char* filename) const;
+
+	//! Saves the counts as comma separated rows of cells
+	void SaveCsv(const char* filename) const;
+
+	const cimg_library::CImg<unsigned int>& counts() const { return counts_; }
+	unsigned long frames() const { return frames_; }
+	int cell() const { return cell_; }
+
+private:
+	const int cell_;
+	unsigned long frames_;
+	cimg_library::CImg<unsigned int> counts_;
+};
+
+#endif // CIMGTEST_LIB_KRABS_HEATMAP_H_
@@ -0,0 +1,155 @@
+#include "krabs_mask.h"
+#include "krabs_motion.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace cimg_library;
+using namespace std;
+
+KrabsSpanMask::KrabsSpanMask(const CImg<unsigned char> &include) :
+	raster_(include.width(), include.height(), 1, 1, 0)
+{
+	row_start_.reserve(include.height() + 1);
+
+	for (int y = 0; y < include.height(); y++)
+	{
+		row_start_.push_back((int)spans_.size());
+
+		const unsigned char *const kRow = include.data(0,y);
+		unsigned char *const kRaster = raster_.data(0,y);
+
+		for (int x = 0; x < include.width();)
+		{
+			if (!kRow[x])
+			{
+				x++;
+				continue;
+			}
+
+			const int kX0 = x;
+			while (x < include.width() && kRow[x])
+				kRaster[x++] = 1;
+
+			spans_.push_back({kX0, x});
+			area_ += x - kX0;
+		}
+	}
+
+	row_start_.push_back((int)spans_.size());
+}
+
+//! Rasterizes a polygon list, see KrabsSpanMask::Load
+static CImg<unsigned char> LoadPolygons(const char* filename, const int width, const int height)
+{
+	ifstream file(filename);
+	if (!file)
+		throw CImgIOException("KrabsSpanMask: Failed to open mask file '%s'.", filename);
+
+	vector<pair<bool, CImg<int>>> polygons;
+	bool any_include = false;
+	string line;
+
+	for (int line_number = 1; getline(file, line); line_number++)
+	{
+		istringstream fields(line);
+		string sign;
+		if (!(fields >> sign) || sign[0] == '#')
+			continue;
+		if (sign != "+" && sign != "-")
+			throw CImgIOException("KrabsSpanMask: Line %d of '%s' does not start with + or -.", line_number, filename);
+
+		vector<int> coordinates;
+		int value;
+		while (fields >> value)
+			coordinates.push_back(value);
+		if (!fields.eof() || coordinates.size() < 6 || coordinates.size()%2)
+			throw CImgIOException("KrabsSpanMask: Line %d of '%s' is not a polygon of 3 points or more.", line_number, filename);
+
+		CImg<int> points((unsigned int)coordinates.size()/2, 2);
+		for (int i = 0; i < points.width(); i++)
+		{
+			points(i,0) = coordinates[2*i];
+			points(i,1) = coordinates[2*i + 1];
+		}
+
+		polygons.push_back(make_pair(sign == "+", points));
+		any_include = any_include || sign == "+";
+	}
+
+	CImg<unsigned char> raster(width, height, 1, 1, any_include ? 0 : 1);
+	const unsigned char kInclude = 1;
+	const unsigned char kExclude = 0;
+
+	for (const pair<bool, CImg<int>> &polygon : polygons)
+		raster.draw_polygon(polygon.second, polygon.first ? &kInclude : &kExclude);
+
+	return raster;
+}
+
+KrabsSpanMask KrabsSpanMask::Load(const char* filename, const int width, const int height)
+{
+	const char *const kExtension = strrchr(filename, '.');
+	string extension(kExtension ? kExtension + 1 : "");
+	for (char &c : extension)
+		c = (char)tolower(c);
+
+	if (extension == "txt")
+		return KrabsSpanMask(LoadPolygons(filename, width, height));
+
+	CImg<unsigned char> image(filename);
+	image.channel(0);
+	if (image.width() != width || image.height() != height)
+		image.resize(width, height, 1, 1, 1);
+
+	return KrabsSpanMask(image);
+}
+
+KrabsSpanMask KrabsSpanMask::Scaled(const int factor) const
+{
+	if (factor <= 1 || is_empty())
+		return *this;
+
+	// 0/255 raster, box decimated, is at least 128 where half the block is included
+
+	CImg<unsigned char> opaque(raster_), decimated;
+	opaque *= 255;
+	KrabsBoxDecimate(opaque, factor, decimated);
+
+	return KrabsSpanMask(decimated.threshold(128));
+}
+
+template<typename T>
+void KrabsSpanMask::Clear(CImg<T> &image) const
+{
+	if (is_empty())
+		return;
+	if (!is_sameXY(image.width(), image.height()))
+		throw CImgArgumentException("KrabsSpanMask: Image size %dx%d differs from the mask size %dx%d.",
+			image.width(), image.height(), width(), height());
+
+	const int kWidth = image.width();
+
+	// only the gaps between spans are written, so the cost follows the excluded area
+
+	#pragma omp parallel for schedule(static) if ((long)kWidth*height() - area_ >= 65536)
+	for (int y = 0; y < height(); y++)
+	{
+		T *const kRow = image.data(0,y);
+		int x = 0;
+
+		for (const Span *span = begin(y); span != end(y); ++span)
+		{
+			fill(kRow + x, kRow + span->x0, (T)0);
+			x = span->x1;
+		}
+		fill(kRow + x, kRow + kWidth, (T)0);
+	}
+}
+
+template void KrabsSpanMask::Clear(CImg<double>&) const;
+template void KrabsSpanMask::Clear(CImg<unsigned char>&) const;
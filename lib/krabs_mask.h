@@ -0,0 +1,65 @@
+#ifndef CIMGTEST_LIB_KRABS_MASK_H_
+#define CIMGTEST_LIB_KRABS_MASK_H_
+
+#include "../CImg.h"
+#include <vector>
+
+//! Area of a frame kept for analysis, compiled into runs of included pixels per row
+/**
+ * Each row holds its included pixels as sorted, disjoint spans [x0, x1), so a step looping over the spans of a row
+ * only spends time on included pixels, and a row without spans is skipped as a whole.
+ *
+ * An empty mask stands for no mask: every step taking one processes the whole frame when it is empty.
+ */
+class KrabsSpanMask
+{
+public:
+	struct Span
+	{
+		int x0;
+		int x1;
+	};
+
+	KrabsSpanMask() {}
+
+	//! Compiles a raster mask, where non zero pixels are included
+	explicit KrabsSpanMask(const cimg_library::CImg<unsigned char> &include);
+
+	//! Loads a mask for width x height frames
+	/**
+	 * A .txt file lists polygons in frame pixels, one per line as "+ x0 y0 x1 y1 ..." to include the polygon or
+	 * "- x0 y0 ..." to exclude it, applied in order. The frame starts included when the file has no include polygon,
+	 * and excluded otherwise. Lines starting with # are comments.
+	 *
+	 * Any other file is loaded as an image, such as a PNG, resized to the frame. Non zero pixels of its first
+	 * channel are included.
+	 */
+	static KrabsSpanMask Load(const char* filename, const int width, const int height);
+
+	//! Mask of frames decimated by factor with KrabsBoxDecimate: a block is included when half its pixels are
+	KrabsSpanMask Scaled(const int factor) const;
+
+	//! Zeroes the excluded pixels of image, which must have the mask size or CImgArgumentException is thrown. Defined for double and unsigned char
+	template<typename T>
+	void Clear(cimg_library::CImg<T> &image) const;
+
+	//! Spans of row y
+	const Span* begin(const int y) const { return spans_.data() + row_start_[y]; }
+	const Span* end(const int y) const { return spans_.data() + row_start_[y + 1]; }
+
+	int width() const { return raster_.width(); }
+	int height() const { return raster_.height(); }
+	bool is_empty() const { return raster_.is_empty(); }
+	bool is_sameXY(const int width, const int height) const { return raster_.width() == width && raster_.height() == height; }
+
+	//! Included pixels
+	long area() const { return area_; }
+
+private:
+	cimg_library::CImg<unsigned char> raster_;
+	std::vector<Span> spans_;
+	std::vector<int> row_start_; // spans of row y are spans_[row_start_[y]..row_start_[y + 1])
+	long area_ = 0;
+};
+
+#endif // CIMGTEST_LIB_KRABS_MASK_H_
@@ -0,0 +1,216 @@
+#include "krabs_model_file.h"
+#include "../CImg.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cimg_library;
+using namespace std;
+
+const char kModelMagic[8] = "KRABSBG";
+
+static_assert(sizeof(KrabsModelHeader) == 64, "model planes must start 64-byte aligned");
+
+KrabsModelFile::KrabsModelFile(const char* filename) :
+	header_(nullptr), size_(0)
+{
+	const int kFile = open(filename, O_RDONLY);
+	if (kFile < 0)
+		return;
+
+	struct stat status;
+	if (fstat(kFile, &status) == 0 && (size_t)status.st_size >= sizeof(KrabsModelHeader))
+	{
+		void *const kMapping = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, kFile, 0);
+		if (kMapping != MAP_FAILED)
+		{
+			header_ = static_cast<const KrabsModelHeader*>(kMapping);
+			size_ = (size_t)status.st_size;
+		}
+	}
+	close(kFile);
+
+	if (!header_)
+		return;
+
+	// a file of another version, or shorter than its planes, is not read at all
+
+	const size_t kPlanes = (size_t)header_->planes*header_->width*header_->height*header_->value_size;
+	if (memcmp(header_->magic, kModelMagic, sizeof(kModelMagic)) || header_->version != kVersion || size_ - sizeof(KrabsModelHeader) < kPlanes)
+	{
+		munmap(const_cast<KrabsModelHeader*>(header_), size_);
+		header_ = nullptr;
+		size_ = 0;
+	}
+}
+
+KrabsModelFile::~KrabsModelFile()
+{
+	if (header_)
+		munmap(const_cast<KrabsModelHeader*>(header_), size_);
+}
+
+bool KrabsModelFile::Holds(const Kind kind, const int width, const int height, const unsigned int planes, const unsigned int value_size) const
+{
+	return header_ && header_->kind == (uint32_t)kind && header_->width == (uint32_t)width && header_->height == (uint32_t)height &&
+		header_->planes == planes && header_->value_size == value_size;
+}
+
+const void* KrabsModelFile::plane(const unsigned int index) const
+{
+	return reinterpret_cast<const char*>(header_ + 1) + (size_t)index*header_->width*header_->height*header_->value_size;
+}
+
+void KrabsModelFile::Write(const char* filename, const Kind kind, const int width, const int height, const unsigned int value_size,
+	const vector<const void*> &planes)
+{
+	KrabsModelHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kModelMagic, sizeof(kModelMagic));
+	header.version = kVersion;
+	header.kind = kind;
+	header.width = width;
+	header.height = height;
+	header.planes = (uint32_t)planes.size();
+	header.value_size = value_size;
+	header.timestamp = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+
+	const string kTemporary = string(filename) + ".tmp";
+	const size_t kPlaneSize = (size_t)width*height*value_size;
+
+	FILE *const kFile = fopen(kTemporary.c_str(), "wb");
+	if (!kFile)
+		throw CImgIOException("KrabsModelFile: Failed to open file '%s' for writing.", kTemporary.c_str());
+
+	bool written = fwrite(&header, sizeof(header), 1, kFile) == 1;
+	for (const void *const kPlane : planes)
+		written = written && fwrite(kPlane, 1, kPlaneSize, kFile) == kPlaneSize;
+	written = fclose(kFile) == 0 && written;
+
+	if (!written || rename(kTemporary.c_str(), filename))
+	{
+		remove(kTemporary.c_str());
+		throw CImgIOException("KrabsModelFile: Failed to save the background model to '%s'.", filename);
+	}
+}
+
+void KrabsModelSnapshot::Assign(const KrabsModelFile::Kind kind, const int width, const int height, const unsigned int value_size,
+	const vector<const void*> &planes)
+{
+	const size_t kPlaneSize = (size_t)width*height*value_size;
+
+	this->kind = kind;
+	this->width = width;
+	this->height = height;
+	this->value_size = value_size;
+	this->planes = (unsigned int)planes.size();
+	data.resize(kPlaneSize*planes.size());
+
+	for (size_t i = 0; i < planes.size(); i++)
+		memcpy(data.data() + i*kPlaneSize, planes[i], kPlaneSize);
+}
+
+void KrabsModelSnapshot::Write(const char* filename) const
+{
+	const size_t kPlaneSize = (size_t)width*height*value_size;
+	vector<const void*> plane_list;
+
+	for (unsigned int i = 0; i < planes; i++)
+		plane_list.push_back(data.data() + i*kPlaneSize);
+
+	KrabsModelFile::Write(filename, kind, width, height, value_size, plane_list);
+}
+
+KrabsModelWriter::KrabsModelWriter() :
+	closing_(false), has_pending_(false), writing_(false)
+{
+	thread_ = thread(&KrabsModelWriter::Run, this);
+}
+
+KrabsModelWriter::~KrabsModelWriter()
+{
+	{
+		lock_guard<mutex> lock(mutex_);
+		closing_ = true;
+	}
+	wake_.notify_one();
+	thread_.join();
+}
+
+void KrabsModelWriter::Submit(const string &filename, KrabsModelSnapshot &snapshot)
+{
+	{
+		lock_guard<mutex> lock(mutex_);
+		pending_file_ = filename;
+		swap(pending_, snapshot);
+		has_pending_ = true;
+	}
+	wake_.notify_one();
+}
+
+void KrabsModelWriter::Flush()
+{
+	unique_lock<mutex> lock(mutex_);
+	written_.wait(lock, [this] { return !has_pending_ && !writing_; });
+}
+
+string KrabsModelWriter::TakeError()
+{
+	lock_guard<mutex> lock(mutex_);
+	string error;
+	error.swap(error_);
+	return error;
+}
+
+void KrabsModelWriter::Run()
+{
+	KrabsModelSnapshot writing;
+	string file;
+
+	unique_lock<mutex> lock(mutex_);
+	for (;;)
+	{
+		wake_.wait(lock, [this] { return closing_ || has_pending_; });
+
+		const bool kClosing = closing_;
+		const bool kWrite = has_pending_;
+		swap(writing, pending_);
+		file.swap(pending_file_);
+		has_pending_ = false;
+		writing_ = kWrite;
+		lock.unlock();
+
+		if (kWrite)
+		{
+			// a failed write is kept for the caller to report, the next snapshot is tried anyway
+
+			string error;
+			try
+			{
+				writing.Write(file.c_str());
+			}
+			catch (CImgException& ex)
+			{
+				error = ex.what();
+			}
+
+			{
+				lock_guard<mutex> error_lock(mutex_);
+				if (!error.empty())
+					error_ = error;
+				writing_ = false;
+			}
+			written_.notify_all();
+		}
+
+		if (kClosing)
+			return;
+		lock.lock();
+	}
+}
@@ -0,0 +1,133 @@
+#ifndef CIMGTEST_LIB_KRABS_MODEL_FILE_H_
+#define CIMGTEST_LIB_KRABS_MODEL_FILE_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//! Header of a background model file, followed by the model planes
+struct KrabsModelHeader
+{
+	char magic[8];          // "KRABSBG"
+	std::uint32_t version;  // KrabsModelFile::kVersion
+	std::uint32_t kind;     // KrabsModelFile::Kind
+	std::uint32_t width;    // frame size the model was learned at
+	std::uint32_t height;
+	std::uint32_t planes;   // width x height planes following the header
+	std::uint32_t value_size;
+	std::int64_t timestamp; // milliseconds since the epoch, when saved
+	char reserved[24];
+};
+
+//! Background model state saved to disk, read back by mapping the file
+/**
+ * The file is a 64-byte KrabsModelHeader then the model planes one after another, each width x height values of
+ * value_size bytes in the native byte order. Planes start 64-byte aligned in the mapping, so the model reads them
+ * in place, without parsing.
+ *
+ * Saves are written next to the file and renamed over it, so the file is always either the previous or the new
+ * state, even when the process is killed while saving.
+ */
+class KrabsModelFile
+{
+public:
+	enum Kind { kRunningAverage = 1, kFixedRunningAverage = 2, kGaussianMixture = 3 };
+
+	//! Bumped whenever the layout of the header or of a model changes
+	static const std::uint32_t kVersion = 1;
+
+	//! Maps filename read only. The file is left closed when missing, truncated or of another version
+	explicit KrabsModelFile(const char* filename);
+
+	~KrabsModelFile();
+
+	KrabsModelFile(const KrabsModelFile&) = delete;
+	KrabsModelFile& operator=(const KrabsModelFile&) = delete;
+
+	//! Whether the file holds a kind model of width x height frames, with planes planes of value_size bytes
+	bool Holds(const Kind kind, const int width, const int height, const unsigned int planes, const unsigned int value_size) const;
+
+	//! Plane index, planes follow each other so several planes can be read as one block
+	const void* plane(const unsigned int index) const;
+
+	bool is_open() const { return header_ != nullptr; }
+	const KrabsModelHeader& header() const { return *header_; }
+
+	//! Saves the planes of a kind model of width x height frames, each plane holding width*height values of value_size bytes
+	/**
+	 * Throws CImgIOException when the file cannot be written.
+	 */
+	static void Write(const char* filename, const Kind kind, const int width, const int height, const unsigned int value_size,
+		const std::vector<const void*> &planes);
+
+private:
+	const KrabsModelHeader* header_;
+	std::size_t size_;
+};
+
+//! Copy of the planes of a model, to be written as a KrabsModelFile while the model goes on learning
+struct KrabsModelSnapshot
+{
+	KrabsModelFile::Kind kind = KrabsModelFile::kRunningAverage;
+	int width = 0;
+	int height = 0;
+	unsigned int value_size = 0;
+	unsigned int planes = 0;
+	std::vector<char> data; // planes one after another
+
+	//! Copies the planes of a kind model of width x height frames, reusing data when it is large enough
+	void Assign(const KrabsModelFile::Kind kind, const int width, const int height, const unsigned int value_size,
+		const std::vector<const void*> &planes);
+
+	//! Saves the planes with KrabsModelFile::Write
+	void Write(const char* filename) const;
+
+	bool is_empty() const { return planes == 0; }
+};
+
+//! Writes model snapshots to their files on a dedicated thread
+/**
+ * A save of the mixture model at 640x480 is about 11 MB, so saving from the frame loop would stall it. The caller
+ * copies the model into a snapshot and swaps it in, and the writer thread writes it. A snapshot submitted before the
+ * previous one was written replaces it, as only the newest state matters.
+ */
+class KrabsModelWriter
+{
+public:
+	KrabsModelWriter();
+
+	//! Writes the pending snapshot, then stops the writer thread
+	~KrabsModelWriter();
+
+	KrabsModelWriter(const KrabsModelWriter&) = delete;
+	KrabsModelWriter& operator=(const KrabsModelWriter&) = delete;
+
+	//! Queues snapshot to be written to filename, swapping in the buffers of an older snapshot for the next copy
+	void Submit(const std::string &filename, KrabsModelSnapshot &snapshot);
+
+	//! Waits until the queued snapshot, if any, is written
+	void Flush();
+
+	//! Message of the last failed write, empty when none failed since the last call
+	std::string TakeError();
+
+private:
+	void Run();
+
+	bool closing_;
+	bool has_pending_;
+	bool writing_;
+	std::string pending_file_;
+	KrabsModelSnapshot pending_;
+	std::string error_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable written_;
+	std::thread thread_;
+};
+
+#endif // CIMGTEST_LIB_KRABS_MODEL_FILE_H_
@@ -0,0 +1,1017 @@
+#include "krabs_motion.h"
+#include "krabs_model_file.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace cimg_library;
+using namespace std;
+
+const float kInitialVariance = 15.0f*15.0f;
+const float kMinVariance = 4.0f*4.0f;
+const float kInitialWeight = 0.05f;
+const int kScratchRows = 8;
+const int kFixedRateBits = 12;
+const int kBlurWeightSum = 256;
+
+void KrabsBackgroundModel::Save(const char* filename) const
+{
+	KrabsModelSnapshot snapshot;
+	Snapshot(snapshot);
+	snapshot.Write(filename);
+}
+
+void KrabsRunningAverage::Initialize(const CImg<double> &gray)
+{
+	background_ = gray;
+}
+
+void KrabsRunningAverage::Apply(const CImg<double> &gray, CImg<double> &foreground)
+{
+	if (!is_initialized() || !background_.is_sameXYZC(gray))
+		Initialize(gray);
+
+	foreground.assign(gray.width(), gray.height(), gray.depth(), gray.spectrum());
+
+	const double kRate = learning_rate_ > 0 ? learning_rate_ : 0;
+	const double kThreshold = threshold_;
+	const long kSize = (long)background_.size();
+	double *const kBackground = background_.data();
+	double *const kForeground = foreground.data();
+	const double *const kGray = gray.data();
+
+	#pragma omp simd
+	for (long i = 0; i < kSize; i++)
+	{
+		const double kDifference = kGray[i] - kBackground[i];
+		kForeground[i] = (kDifference >= 0 ? kDifference : -kDifference) >= kThreshold ? 1 : 0;
+		kBackground[i] += kRate*kDifference;
+	}
+}
+
+void KrabsRunningAverage::Initialize(const CImg<unsigned char> &gray)
+{
+	fixed_background_.assign(gray.width(), gray.height(), gray.depth(), gray.spectrum());
+
+	const long kSize = (long)gray.size();
+	const unsigned char *const kGray = gray.data();
+	unsigned short *const kBackground = fixed_background_.data();
+
+	#pragma omp simd
+	for (long i = 0; i < kSize; i++)
+		kBackground[i] = (unsigned short)(kGray[i] << 8);
+}
+
+void KrabsRunningAverage::Apply(const CImg<unsigned char> &gray, CImg<unsigned char> &foreground)
+{
+	if (!fixed_background_.is_sameXYZC(gray))
+		Initialize(gray);
+
+	foreground.assign(gray.width(), gray.height(), gray.depth(), gray.spectrum());
+
+	// |difference| >= threshold on integers is |difference| >= ceil(threshold)
+
+	// a positive rate below the resolution still learns, at the smallest rate
+
+	const int kRate = learning_rate_ > 0 ? max(1, (int)(learning_rate_*(1 << kFixedRateBits) + 0.5f)) : 0;
+	const int kRounding = 1 << (kFixedRateBits - 1);
+	const int kThreshold = (int)ceil(threshold_);
+	const long kSize = (long)fixed_background_.size();
+	unsigned short *const kBackground = fixed_background_.data();
+	unsigned char *const kForeground = foreground.data();
+	const unsigned char *const kGray = gray.data();
+
+	#pragma omp simd
+	for (long i = 0; i < kSize; i++)
+	{
+		const int kFixed = kBackground[i];
+		const int kValue = kGray[i];
+		const int kDifference = kValue - ((kFixed + 128) >> 8);
+		const int kAbsolute = kDifference >= 0 ? kDifference : -kDifference;
+
+		kForeground[i] = kAbsolute >= kThreshold ? 1 : 0;
+		kBackground[i] = (unsigned short)(kFixed + ((((kValue << 8) - kFixed)*kRate + kRounding) >> kFixedRateBits));
+	}
+}
+
+bool KrabsRunningAverage::Load(const char* filename, const CImg<double> &gray)
+{
+	const KrabsModelFile kFile(filename);
+
+	if (!kFile.Holds(KrabsModelFile::kRunningAverage, gray.width(), gray.height(), gray.spectrum(), sizeof(double)))
+	{
+		Initialize(gray);
+		return false;
+	}
+
+	background_.assign(static_cast<const double*>(kFile.plane(0)), gray.width(), gray.height(), 1, gray.spectrum());
+	return true;
+}
+
+bool KrabsRunningAverage::Load(const char* filename, const CImg<unsigned char> &gray)
+{
+	const KrabsModelFile kFile(filename);
+
+	if (!kFile.Holds(KrabsModelFile::kFixedRunningAverage, gray.width(), gray.height(), gray.spectrum(), sizeof(unsigned short)))
+	{
+		Initialize(gray);
+		return false;
+	}
+
+	fixed_background_.assign(static_cast<const unsigned short*>(kFile.plane(0)), gray.width(), gray.height(), 1, gray.spectrum());
+	return true;
+}
+
+void KrabsRunningAverage::Snapshot(KrabsModelSnapshot &snapshot) const
+{
+	vector<const void*> planes;
+
+	if (!fixed_background_.is_empty())
+	{
+		for (int c = 0; c < fixed_background_.spectrum(); c++)
+			planes.push_back(fixed_background_.data(0,0,0,c));
+		snapshot.Assign(KrabsModelFile::kFixedRunningAverage, fixed_background_.width(), fixed_background_.height(), sizeof(unsigned short), planes);
+	}
+	else if (!background_.is_empty())
+	{
+		for (int c = 0; c < background_.spectrum(); c++)
+			planes.push_back(background_.data(0,0,0,c));
+		snapshot.Assign(KrabsModelFile::kRunningAverage, background_.width(), background_.height(), sizeof(double), planes);
+	}
+	else
+		throw CImgArgumentException("KrabsRunningAverage: Cannot save the model before it is initialized.");
+}
+
+void KrabsRunningAverage::ByteBackground(CImg<unsigned char> &gray) const
+{
+	gray.assign(fixed_background_.width(), fixed_background_.height(), fixed_background_.depth(), fixed_background_.spectrum());
+
+	const long kSize = (long)fixed_background_.size();
+	const unsigned short *const kBackground = fixed_background_.data();
+	unsigned char *const kGray = gray.data();
+
+	#pragma omp simd
+	for (long i = 0; i < kSize; i++)
+	{
+		const int kRounded = ((int)kBackground[i] + 128) >> 8;
+		kGray[i] = (unsigned char)(kRounded < 255 ? kRounded : 255);
+	}
+}
+
+KrabsGaussianMixture::KrabsGaussianMixture(const float learning_rate, const float background_ratio, const float match_sigmas) :
+	learning_rate_(learning_rate), background_ratio_(background_ratio), match_sigmas_(match_sigmas)
+{
+}
+
+void KrabsGaussianMixture::Initialize(const CImg<double> &gray)
+{
+	Seed(gray);
+}
+
+void KrabsGaussianMixture::Initialize(const CImg<unsigned char> &gray)
+{
+	Seed(gray);
+}
+
+void KrabsGaussianMixture::Apply(const CImg<double> &gray, CImg<double> &foreground)
+{
+	Update(gray, foreground);
+}
+
+void KrabsGaussianMixture::Apply(const CImg<unsigned char> &gray, CImg<unsigned char> &foreground)
+{
+	Update(gray, foreground);
+}
+
+bool KrabsGaussianMixture::Load(const char* filename, const CImg<double> &gray)
+{
+	return Restore(filename, gray);
+}
+
+bool KrabsGaussianMixture::Load(const char* filename, const CImg<unsigned char> &gray)
+{
+	return Restore(filename, gray);
+}
+
+template<typename T>
+bool KrabsGaussianMixture::Restore(const char* filename, const CImg<T> &gray)
+{
+	const KrabsModelFile kFile(filename);
+
+	// weights, means and variances, each as kMixtureComponents planes
+
+	if (!kFile.Holds(KrabsModelFile::kGaussianMixture, gray.width(), gray.height(), 3*kMixtureComponents, sizeof(float)))
+	{
+		Seed(gray);
+		return false;
+	}
+
+	weights_.assign(static_cast<const float*>(kFile.plane(0)), gray.width(), gray.height(), 1, kMixtureComponents);
+	means_.assign(static_cast<const float*>(kFile.plane(kMixtureComponents)), gray.width(), gray.height(), 1, kMixtureComponents);
+	variances_.assign(static_cast<const float*>(kFile.plane(2*kMixtureComponents)), gray.width(), gray.height(), 1, kMixtureComponents);
+	return true;
+}
+
+void KrabsGaussianMixture::Snapshot(KrabsModelSnapshot &snapshot) const
+{
+	if (!is_initialized())
+		throw CImgArgumentException("KrabsGaussianMixture: Cannot save the model before it is initialized.");
+
+	vector<const void*> planes;
+	for (const CImg<float> *const kState : {&weights_, &means_, &variances_})
+		for (int k = 0; k < kMixtureComponents; k++)
+			planes.push_back(kState->data(0,0,0,k));
+
+	snapshot.Assign(KrabsModelFile::kGaussianMixture, weights_.width(), weights_.height(), sizeof(float), planes);
+}
+
+template<typename T>
+void KrabsGaussianMixture::Seed(const CImg<T> &gray)
+{
+	// first component takes the frame with full weight, the others wait to be replaced
+
+	weights_.assign(gray.width(), gray.height(), 1, kMixtureComponents, 0);
+	means_.assign(gray.width(), gray.height(), 1, kMixtureComponents, 0);
+	variances_.assign(gray.width(), gray.height(), 1, kMixtureComponents, kInitialVariance);
+
+	cimg_forXY(gray,x,y)
+	{
+		weights_(x,y,0,0) = 1;
+		means_(x,y,0,0) = (float)gray(x,y);
+	}
+}
+
+template<typename T>
+void KrabsGaussianMixture::Update(const CImg<T> &gray, CImg<T> &foreground)
+{
+	if (!is_initialized() || weights_.width() != gray.width() || weights_.height() != gray.height())
+		Seed(gray);
+
+	foreground.assign(gray.width(), gray.height(), 1, 1);
+
+	const int kWidth = gray.width();
+	const float kRate = learning_rate_;
+	const float kRatio = background_ratio_;
+	const float kMatch = match_sigmas_*match_sigmas_;
+
+	#pragma omp parallel
+	{
+		// each step is a separate pass over the row, so every loop is a plain vectorizable kernel over the planes.
+		// selects only pick loaded values, since arithmetic on a selected value is turned back into branches.
+
+		CImg<float> scratch(kWidth, kScratchRows);
+		CImg<int> components(kWidth, 2);
+		float *const kValue     = scratch.data(0,0);
+		float *const kLowest    = scratch.data(0,1);
+		float *const kOwnW      = scratch.data(0,2);
+		float *const kOwnV      = scratch.data(0,3);
+		float *const kAhead     = scratch.data(0,4);
+		float *const kTotal     = scratch.data(0,5);
+		float *const kOwnership = scratch.data(0,6);
+		float *const kReplacing = scratch.data(0,7);
+		int *const kMatched     = components.data(0,0);
+		int *const kWeakest     = components.data(0,1);
+
+		#pragma omp for schedule(static)
+		for (int y = 0; y < gray.height(); y++)
+		{
+			const T *const kGray = gray.data(0,y);
+			T *const kForeground = foreground.data(0,y);
+
+			#pragma omp simd
+			for (int x = 0; x < kWidth; x++)
+			{
+				kValue[x]   = (float)kGray[x];
+				kMatched[x] = kMixtureComponents;
+				kWeakest[x] = 0;
+				kLowest[x]  = weights_(x,y,0,0);
+				kOwnW[x]    = 0;
+				kOwnV[x]    = 1;
+				kAhead[x]   = 0;
+				kTotal[x]   = 0;
+			}
+
+			// (1) first matching component, and the weakest one to be replaced when nothing matches
+
+			for (int k = kMixtureComponents-1; k >= 0; k--)
+			{
+				const float *const kW = weights_.data(0,y,0,k);
+				const float *const kM = means_.data(0,y,0,k);
+				const float *const kV = variances_.data(0,y,0,k);
+
+				#pragma omp simd
+				for (int x = 0; x < kWidth; x++)
+				{
+					const float kWeight = kW[x];
+					const float kLow = kLowest[x];
+					const float kDistance = kValue[x] - kM[x];
+					const bool kMatches = (kWeight > 0) & (kDistance*kDistance < kMatch*kV[x]);
+					const int kPrevious = kMatched[x];
+					const int kPreviousWeakest = kWeakest[x];
+
+					kMatched[x] = kMatches ? k : kPrevious;
+					kWeakest[x] = kWeight < kLow ? k : kPreviousWeakest;
+					kLowest[x]  = kWeight < kLow ? kWeight : kLow;
+				}
+			}
+
+			// (2) background when the matched component ranks, by weight/sigma, within the background ratio
+
+			for (int k = 0; k < kMixtureComponents; k++)
+			{
+				const float *const kW = weights_.data(0,y,0,k);
+				const float *const kV = variances_.data(0,y,0,k);
+
+				#pragma omp simd
+				for (int x = 0; x < kWidth; x++)
+				{
+					const bool kOwner = kMatched[x] == k;
+					const float kWeight = kW[x];
+					const float kVariance = kV[x];
+					const float kPreviousW = kOwnW[x];
+					const float kPreviousV = kOwnV[x];
+
+					kOwnW[x] = kOwner ? kWeight : kPreviousW;
+					kOwnV[x] = kOwner ? kVariance : kPreviousV;
+				}
+			}
+
+			for (int k = 0; k < kMixtureComponents; k++)
+			{
+				const float *const kW = weights_.data(0,y,0,k);
+				const float *const kV = variances_.data(0,y,0,k);
+
+				#pragma omp simd
+				for (int x = 0; x < kWidth; x++)
+				{
+					const float kWeight = kW[x];
+					const float kOwnWeight = kOwnW[x];
+					const bool kRanksAhead = (kMatched[x] != k) & (kWeight*kWeight*kOwnV[x] > kOwnWeight*kOwnWeight*kV[x]);
+					kAhead[x] += kRanksAhead ? kWeight : 0;
+				}
+			}
+
+			#pragma omp simd
+			for (int x = 0; x < kWidth; x++)
+				kForeground[x] = ((kMatched[x] == kMixtureComponents) | (kAhead[x] >= kRatio)) ? 1 : 0;
+
+			// (3) update weights, the matched gaussian, or replace the weakest one
+
+			for (int k = 0; k < kMixtureComponents; k++)
+			{
+				float *const kW = weights_.data(0,y,0,k);
+				float *const kM = means_.data(0,y,0,k);
+				float *const kV = variances_.data(0,y,0,k);
+
+				// ownership and replacement are staged as 0/1 factors, keeping the update below free of branches
+
+				#pragma omp simd
+				for (int x = 0; x < kWidth; x++)
+				{
+					kOwnership[x] = kMatched[x] == k ? 1.0f : 0.0f;
+					kReplacing[x] = ((kMatched[x] == kMixtureComponents) & (kWeakest[x] == k)) ? 1.0f : 0.0f;
+				}
+
+				#pragma omp simd
+				for (int x = 0; x < kWidth; x++)
+				{
+					const float kDistance = kValue[x] - kM[x];
+					const float kLearned = kW[x] + kRate*(kOwnership[x] - kW[x]);
+					const float kRho = kOwnership[x]*kRate/(kLearned > kRate ? kLearned : kRate);
+					const float kLearnedVariance = kV[x] + kRho*(kDistance*kDistance - kV[x]);
+					const float kVariance = kLearnedVariance + kReplacing[x]*(kInitialVariance - kLearnedVariance);
+					const float kWeight = kLearned + kReplacing[x]*(kInitialWeight - kLearned);
+
+					kM[x] += (kRho + kReplacing[x]*(1 - kRho))*kDistance;
+					kV[x] = kVariance > kMinVariance ? kVariance : kMinVariance;
+					kW[x] = kWeight;
+					kTotal[x] += kWeight;
+				}
+			}
+
+			for (int k = 0; k < kMixtureComponents; k++)
+			{
+				float *const kW = weights_.data(0,y,0,k);
+
+				#pragma omp simd
+				for (int x = 0; x < kWidth; x++)
+					kW[x] /= kTotal[x];
+			}
+		}
+	}
+}
+
+void KrabsLuminance(const CImg<double> &image, CImg<unsigned char> &gray)
+{
+	gray.assign(image.width(), image.height());
+
+	const long kSize = (long)image.width()*image.height();
+	unsigned char *const kGray = gray.data();
+
+	if (image.spectrum() < 3)
+	{
+		const double *const kValue = image.data();
+
+		#pragma omp simd
+		for (long i = 0; i < kSize; i++)
+			kGray[i] = (unsigned char)kValue[i];
+		return;
+	}
+
+	const double *const kRed = image.data(0,0,0,0);
+	const double *const kGreen = image.data(0,0,0,1);
+	const double *const kBlue = image.data(0,0,0,2);
+
+	#pragma omp simd
+	for (long i = 0; i < kSize; i++)
+		kGray[i] = (unsigned char)((77*(int)kRed[i] + 150*(int)kGreen[i] + 29*(int)kBlue[i] + 128) >> 8);
+}
+
+//! Rounds block averages of integer pixels and keeps floating point ones as they are
+template<typename T> static inline T BlockAverage(const double sum, const double block_area) { return (T)(sum/block_area); }
+template<> inline unsigned char BlockAverage<unsigned char>(const double sum, const double block_area) { return (unsigned char)(sum/block_area + 0.5); }
+
+template<typename T>
+void KrabsBoxDecimate(const CImg<T> &image, const int factor, CImg<T> &decimated)
+{
+	if (factor <= 1)
+	{
+		decimated = image;
+		return;
+	}
+
+	const int kWidth = image.width()/factor;
+	const int kHeight = image.height()/factor;
+	const double kBlockArea = (double)factor*factor;
+
+	decimated.assign(kWidth, kHeight, 1, image.spectrum());
+
+	#pragma omp parallel
+	{
+		// column sums over the block rows, then sums of factor consecutive columns
+
+		CImg<double> columns(kWidth*factor);
+		double *const kColumns = columns.data();
+
+		#pragma omp for collapse(2) schedule(static)
+		for (int c = 0; c < image.spectrum(); c++)
+			for (int y = 0; y < kHeight; y++)
+			{
+				const T *const kFirst = image.data(0, y*factor, 0, c);
+
+				#pragma omp simd
+				for (int x = 0; x < kWidth*factor; x++)
+					kColumns[x] = kFirst[x];
+
+				for (int row = 1; row < factor; row++)
+				{
+					const T *const kRow = image.data(0, y*factor + row, 0, c);
+
+					#pragma omp simd
+					for (int x = 0; x < kWidth*factor; x++)
+						kColumns[x] += kRow[x];
+				}
+
+				T *const kTarget = decimated.data(0, y, 0, c);
+
+				for (int x = 0; x < kWidth; x++)
+				{
+					double sum = 0;
+					for (int i = 0; i < factor; i++)
+						sum += kColumns[x*factor + i];
+					kTarget[x] = BlockAverage<T>(sum, kBlockArea);
+				}
+			}
+	}
+}
+
+//! Replicates the border for indexes out of [0, length)
+static inline int Clamp(const int index, const int length)
+{
+	return index < 0 ? 0 : (index < length ? index : length - 1);
+}
+
+//! Quantized gaussian weights of the fixed point blur, the center takes the rounding error so they sum to kBlurWeightSum
+/**
+ * \return Kernel radius, the kernel has 2*radius + 1 taps
+ */
+static int BlurWeights(const float sigma, vector<unsigned short> &weights)
+{
+	const int kRadius = (int)ceil(3*sigma);
+	const int kTaps = 2*kRadius + 1;
+	vector<double> gaussian(kTaps);
+	double total = 0;
+	int quantized = 0;
+
+	weights.resize(kTaps);
+	for (int k = 0; k < kTaps; k++)
+	{
+		gaussian[k] = exp(-(double)(k - kRadius)*(k - kRadius)/(2.0*sigma*sigma));
+		total += gaussian[k];
+	}
+	for (int k = 0; k < kTaps; k++)
+	{
+		weights[k] = (unsigned short)(gaussian[k]*kBlurWeightSum/total + 0.5);
+		quantized += weights[k];
+	}
+	weights[kRadius] = (unsigned short)(weights[kRadius] + kBlurWeightSum - quantized);
+
+	return kRadius;
+}
+
+//! Writes the weighted sum of the tap rows to target[x0..x1)
+/**
+ * \param source Called as source(k), returns the row tap k reads, indexed like target
+ */
+template<typename TapSource>
+static inline void BlurSpan(const vector<unsigned short> &weights, const TapSource &source, const int x0, const int x1,
+	unsigned short *const sum, unsigned char *const target)
+{
+	#pragma omp simd
+	for (int x = x0; x < x1; x++)
+		sum[x] = kBlurWeightSum/2;
+
+	for (size_t k = 0; k < weights.size(); k++)
+	{
+		const unsigned short kWeight = weights[k];
+		const unsigned char *const kSource = source(k);
+
+		#pragma omp simd
+		for (int x = x0; x < x1; x++)
+			sum[x] = (unsigned short)(sum[x] + kWeight*kSource[x]);
+	}
+
+	#pragma omp simd
+	for (int x = x0; x < x1; x++)
+		target[x] = (unsigned char)(sum[x] >> 8);
+}
+
+void KrabsFixedBlur(CImg<unsigned char> &gray, const float sigma)
+{
+	if (sigma <= 0 || gray.is_empty())
+		return;
+
+	vector<unsigned short> weights;
+	const int kRadius = BlurWeights(sigma, weights);
+	const int kWidth = gray.width();
+	const int kHeight = gray.height();
+	CImg<unsigned char> rows(kWidth, kHeight);
+
+	#pragma omp parallel
+	{
+		CImg<unsigned char> padded(kWidth + 2*kRadius);
+		CImg<unsigned short> sum(kWidth);
+		unsigned char *const kPadded = padded.data();
+
+		// horizontal pass over rows padded with their border pixels
+
+		#pragma omp for schedule(static)
+		for (int y = 0; y < kHeight; y++)
+		{
+			const unsigned char *const kRow = gray.data(0,y);
+
+			for (int x = 0; x < kRadius; x++)
+			{
+				kPadded[x] = kRow[0];
+				kPadded[kRadius + kWidth + x] = kRow[kWidth - 1];
+			}
+			memcpy(kPadded + kRadius, kRow, kWidth);
+
+			BlurSpan(weights, [=](const int k) { return kPadded + k; }, 0, kWidth, sum.data(), rows.data(0,y));
+		}
+
+		// vertical pass, clamping row indexes at the borders
+
+		#pragma omp for schedule(static)
+		for (int y = 0; y < kHeight; y++)
+			BlurSpan(weights, [&](const int k) { return rows.data(0, Clamp(y + k - kRadius, kHeight)); }, 0, kWidth, sum.data(), gray.data(0,y));
+	}
+}
+
+void KrabsFixedBlur(CImg<unsigned char> &gray, const float sigma, const KrabsSpanMask &spans)
+{
+	if (spans.is_empty())
+	{
+		KrabsFixedBlur(gray, sigma);
+		return;
+	}
+	if (sigma <= 0 || gray.is_empty())
+		return;
+
+	vector<unsigned short> weights;
+	const int kRadius = BlurWeights(sigma, weights);
+	const int kWidth = gray.width();
+	const int kHeight = gray.height();
+	CImg<unsigned char> rows(kWidth, kHeight);
+
+	#pragma omp parallel
+	{
+		CImg<unsigned char> padded(kWidth + 2*kRadius);
+		CImg<unsigned short> sum(kWidth);
+		vector<KrabsSpanMask::Span> needed;
+
+		// horizontal pass over the pixels the vertical pass reads: the spans of the rows within the radius, merged
+
+		#pragma omp for schedule(dynamic, kScratchRows)
+		for (int y = 0; y < kHeight; y++)
+		{
+			needed.clear();
+			for (int row = (y - kRadius > 0 ? y - kRadius : 0); row <= y + kRadius && row < kHeight; row++)
+				needed.insert(needed.end(), spans.begin(row), spans.end(row));
+			if (needed.empty())
+				continue;
+
+			sort(needed.begin(), needed.end(), [](const KrabsSpanMask::Span &a, const KrabsSpanMask::Span &b) { return a.x0 < b.x0; });
+
+			// padded[kRadius + x] holds the row pixel at x, replicated past the borders
+
+			const unsigned char *const kRow = gray.data(0,y);
+			unsigned char *const kPadded = padded.data() + kRadius;
+			size_t merged = 0;
+
+			for (size_t i = 1; i <= needed.size(); i++)
+			{
+				if (i < needed.size() && needed[i].x0 <= needed[merged].x1)
+				{
+					needed[merged].x1 = max(needed[merged].x1, needed[i].x1);
+					continue;
+				}
+
+				const int kX0 = needed[merged].x0;
+				const int kX1 = needed[merged].x1;
+
+				for (int x = kX0 - kRadius; x < kX1 + kRadius; x++)
+					kPadded[x] = kRow[Clamp(x, kWidth)];
+
+				BlurSpan(weights, [=](const int k) { return kPadded + k - kRadius; }, kX0, kX1, sum.data(), rows.data(0,y));
+
+				if (i < needed.size())
+					needed[++merged] = needed[i];
+			}
+		}
+
+		// vertical pass over the spans, excluded pixels keep their value
+
+		#pragma omp for schedule(dynamic, kScratchRows)
+		for (int y = 0; y < kHeight; y++)
+			for (const KrabsSpanMask::Span *span = spans.begin(y); span != spans.end(y); ++span)
+				BlurSpan(weights, [&](const int k) { return rows.data(0, Clamp(y + k - kRadius, kHeight)); }, span->x0, span->x1, sum.data(), gray.data(0,y));
+	}
+}
+
+//! Window of CImg dilate along an axis, covering [x - before, x + after - 1]
+static void DilateWindow(const int size, const int length, int &before, int &after)
+{
+	// CImg dilate leaves an axis alone for sizes below 2, and spreads the maximum over the whole axis
+	// when the window reaches its last pixel from the first one
+
+	if (size <= 1)
+	{
+		before = 0;
+		after = 1;
+	}
+	else if (size - size/2 >= length - 1)
+	{
+		before = length;
+		after = length;
+	}
+	else
+	{
+		before = size/2;
+		after = size - size/2;
+	}
+}
+
+//! Horizontal dilation of a row
+/**
+ * prefix[j] counts the set pixels before j - before, clamped to the row,
+ * so the window of x holds prefix[x + before + after] - prefix[x] set pixels.
+ */
+static void DilateRow(const unsigned char *const row, const int width, const int before, const int after, int *const prefix, unsigned char *const target)
+{
+	const int kSize = before + after;
+	int count = 0;
+
+	for (int j = 0; j <= before; j++)
+		prefix[j] = 0;
+	for (int x = 0; x < width; x++)
+	{
+		count += row[x] ? 1 : 0;
+		prefix[before + 1 + x] = count;
+	}
+	for (int j = before + width + 1; j < width + kSize; j++)
+		prefix[j] = count;
+
+	#pragma omp simd
+	for (int x = 0; x < width; x++)
+		target[x] = prefix[x + kSize] - prefix[x] > 0 ? 1 : 0;
+}
+
+//! Dilates a binary mask whose rows are produced on demand
+/**
+ * \param source Called as source(y, scratch), returns row y of the mask, either written to scratch or stored elsewhere,
+ *        or nullptr when the row is empty
+ *
+ * Each thread takes a strip of output rows and slides a window of horizontally dilated rows down it, keeping
+ * them in a ring along with a count of set pixels per column. Source rows are produced, dilated and counted
+ * while they are still in cache, and only the rows bordering the strip are produced twice.
+ */
+template<typename RowSource>
+static void StreamDilate(const int width, const int height, const int size, const RowSource &source, CImg<unsigned char> &mask)
+{
+	int row_before, row_after, before, after;
+	DilateWindow(size, width, row_before, row_after);
+	DilateWindow(size, height, before, after);
+	const int kWindow = before + after;
+
+	mask.assign(width, height);
+
+	#pragma omp parallel
+	{
+#ifdef _OPENMP
+		const int kStrips = omp_get_num_threads();
+		const int kStrip = omp_get_thread_num();
+#else
+		const int kStrips = 1;
+		const int kStrip = 0;
+#endif
+		const int kBegin = (int)((long)height*kStrip/kStrips);
+		const int kEnd = (int)((long)height*(kStrip + 1)/kStrips);
+
+		CImg<unsigned char> scratch(width);
+		CImg<int> prefix(width + row_before + row_after);
+		CImg<unsigned char> ring(width, kWindow);
+		CImg<int> counts(width, 1, 1, 1, 0);
+		int *const kCounts = counts.data();
+
+		// after row r is counted, the window of row r - after + 1 is complete
+
+		const int kFirst = kBegin - before > 0 ? kBegin - before : 0;
+		for (int r = kFirst; kBegin < kEnd && r <= kEnd + after - 2; r++)
+		{
+			unsigned char *const kSlot = ring.data(0, r % kWindow);
+
+			if (r - kWindow >= kFirst)
+			{
+				#pragma omp simd
+				for (int x = 0; x < width; x++)
+					kCounts[x] -= kSlot[x];
+			}
+
+			const unsigned char *const kRow = r < height ? source(r, scratch.data()) : nullptr;
+			if (kRow)
+			{
+				DilateRow(kRow, width, row_before, row_after, prefix.data(), kSlot);
+
+				#pragma omp simd
+				for (int x = 0; x < width; x++)
+					kCounts[x] += kSlot[x];
+			}
+			else
+				memset(kSlot, 0, width);
+
+			const int y = r - after + 1;
+			if (y >= kBegin)
+			{
+				unsigned char *const kTarget = mask.data(0,y);
+
+				#pragma omp simd
+				for (int x = 0; x < width; x++)
+					kTarget[x] = kCounts[x] > 0 ? 1 : 0;
+			}
+		}
+	}
+}
+
+void KrabsDilateMask(CImg<unsigned char> &mask, const int size)
+{
+	if (size <= 1 || mask.is_empty())
+		return;
+
+	const CImg<unsigned char> kSource(mask);
+
+	StreamDilate(kSource.width(), kSource.height(), size, [&](const int y, unsigned char*) { return kSource.data(0,y); }, mask);
+}
+
+//! Type differences of T are taken in, and the threshold they are compared to
+/**
+ * Byte differences stay integer: |difference| >= threshold on integers is |difference| >= ceil(threshold).
+ */
+template<typename T> struct Difference
+{
+	typedef double type;
+	static type Threshold(const double threshold) { return threshold; }
+};
+
+template<> struct Difference<unsigned char>
+{
+	typedef int type;
+	static type Threshold(const double threshold) { return threshold > 256 ? 256 : (int)ceil(threshold); }
+};
+
+//! Writes |reference - gray| >= threshold to row[x0..x1)
+template<typename T, typename D>
+static inline void ThresholdSpan(const T *const reference, const T *const gray, const int x0, const int x1, const D threshold, unsigned char *const row)
+{
+	#pragma omp simd
+	for (int x = x0; x < x1; x++)
+	{
+		const D kDifference = (D)reference[x] - (D)gray[x];
+		row[x] = (kDifference >= 0 ? kDifference : -kDifference) >= threshold ? 1 : 0;
+	}
+}
+
+//! Throws CImgArgumentException unless reference and spans, when not empty, have the size of gray
+template<typename T>
+static void CheckMotionSizes(const char* function, const CImg<T> &reference, const CImg<T> &gray, const KrabsSpanMask &spans)
+{
+	if (!reference.is_sameXY(gray))
+		throw CImgArgumentException("%s: Reference size %dx%d differs from the frame size %dx%d.", function,
+			reference.width(), reference.height(), gray.width(), gray.height());
+	if (!spans.is_empty() && !spans.is_sameXY(gray.width(), gray.height()))
+		throw CImgArgumentException("%s: Mask size %dx%d differs from the frame size %dx%d.", function,
+			spans.width(), spans.height(), gray.width(), gray.height());
+}
+
+template<typename T>
+void KrabsMotionMask(const CImg<T> &reference, const CImg<T> &gray, const double threshold, const int dilate, CImg<unsigned char> &mask)
+{
+	KrabsMotionMask(reference, gray, threshold, dilate, CImg<unsigned char>(), 0, mask);
+}
+
+template<typename T>
+void KrabsMotionMask(const CImg<T> &reference, const CImg<T> &gray, const double threshold, const int dilate,
+	const CImg<unsigned char> &active, const int block, CImg<unsigned char> &mask)
+{
+	KrabsMotionMask(reference, gray, threshold, dilate, active, block, KrabsSpanMask(), mask);
+}
+
+template<typename T>
+void KrabsMotionMask(const CImg<T> &reference, const CImg<T> &gray, const double threshold, const int dilate,
+	const CImg<unsigned char> &active, const int block, const KrabsSpanMask &spans, CImg<unsigned char> &mask)
+{
+	typedef typename Difference<T>::type D;
+
+	CheckMotionSizes("KrabsMotionMask", reference, gray, spans);
+	if (!active.is_empty() && (block <= 0 || !active.is_sameXY((gray.width() + block - 1)/block, (gray.height() + block - 1)/block)))
+		throw CImgArgumentException("KrabsMotionMask: Active map size %dx%d does not match the frame size %dx%d for blocks of %d.",
+			active.width(), active.height(), gray.width(), gray.height(), block);
+
+	const int kWidth = gray.width();
+	const D kThreshold = Difference<T>::Threshold(threshold);
+	const bool kAllActive = active.is_empty();
+	const bool kAllIncluded = spans.is_empty();
+
+	StreamDilate(kWidth, gray.height(), dilate, [&](const int y, unsigned char *const row) -> const unsigned char* {
+		const T *const kReference = reference.data(0,y);
+		const T *const kGray = gray.data(0,y);
+		const unsigned char *const kActive = kAllActive ? nullptr : active.data(0, y/block);
+
+		// thresholds row[x0..x1), leaving inactive blocks empty, and tells whether any of it was thresholded
+
+		const auto kThresholdSpan = [&](const int x0, const int x1) {
+			if (kAllActive)
+			{
+				ThresholdSpan(kReference, kGray, x0, x1, kThreshold, row);
+				return x0 < x1;
+			}
+
+			bool any_active = false;
+			for (int bx = x0/block; bx*block < x1; bx++)
+			{
+				const int kX0 = bx*block > x0 ? bx*block : x0;
+				const int kX1 = (bx + 1)*block < x1 ? (bx + 1)*block : x1;
+
+				if (kActive[bx])
+				{
+					ThresholdSpan(kReference, kGray, kX0, kX1, kThreshold, row);
+					any_active = true;
+				}
+				else
+					memset(row + kX0, 0, kX1 - kX0);
+			}
+			return any_active;
+		};
+
+		if (kAllIncluded)
+			return kThresholdSpan(0, kWidth) ? row : nullptr;
+
+		// excluded pixels are left empty, and a row without included pixels is empty as a whole
+
+		if (spans.begin(y) == spans.end(y))
+			return nullptr;
+
+		bool any_active = false;
+		int x = 0;
+
+		for (const KrabsSpanMask::Span *span = spans.begin(y); span != spans.end(y); ++span)
+		{
+			memset(row + x, 0, span->x0 - x);
+			any_active = kThresholdSpan(span->x0, span->x1) || any_active;
+			x = span->x1;
+		}
+		memset(row + x, 0, kWidth - x);
+
+		return any_active ? row : nullptr;
+	}, mask);
+}
+
+template<typename T>
+int KrabsBlockMotion(const CImg<T> &reference, const CImg<T> &gray, const int block, const double min_sum, CImg<unsigned char> &active)
+{
+	return KrabsBlockMotion(reference, gray, block, min_sum, KrabsSpanMask(), active);
+}
+
+template<typename T>
+int KrabsBlockMotion(const CImg<T> &reference, const CImg<T> &gray, const int block, const double min_sum, const KrabsSpanMask &spans,
+	CImg<unsigned char> &active)
+{
+	typedef typename Difference<T>::type D;
+
+	CheckMotionSizes("KrabsBlockMotion", reference, gray, spans);
+
+	const int kWidth = gray.width();
+	const int kHeight = gray.height();
+	const int kBlocksX = (kWidth + block - 1)/block;
+	const int kBlocksY = (kHeight + block - 1)/block;
+	const bool kAllIncluded = spans.is_empty();
+	int active_count = 0;
+
+	active.assign(kBlocksX, kBlocksY);
+
+	#pragma omp parallel reduction(+:active_count)
+	{
+		// absolute differences are summed down the columns of a block row, then across each block
+
+		CImg<D> columns(kWidth);
+		D *const kColumns = columns.data();
+
+		#pragma omp for schedule(static)
+		for (int by = 0; by < kBlocksY; by++)
+		{
+			const int kY1 = (by + 1)*block < kHeight ? (by + 1)*block : kHeight;
+
+			#pragma omp simd
+			for (int x = 0; x < kWidth; x++)
+				kColumns[x] = 0;
+
+			for (int y = by*block; y < kY1; y++)
+			{
+				const T *const kReference = reference.data(0,y);
+				const T *const kGray = gray.data(0,y);
+
+				// only included pixels are differenced, excluded ones count as unchanged
+
+				const KrabsSpanMask::Span kRow = {0, kWidth};
+				const KrabsSpanMask::Span *const kBegin = kAllIncluded ? &kRow : spans.begin(y);
+				const KrabsSpanMask::Span *const kEnd = kAllIncluded ? &kRow + 1 : spans.end(y);
+
+				for (const KrabsSpanMask::Span *span = kBegin; span != kEnd; ++span)
+				{
+					const int kX0 = span->x0;
+					const int kX1 = span->x1;
+
+					#pragma omp simd
+					for (int x = kX0; x < kX1; x++)
+					{
+						const D kDifference = (D)kReference[x] - (D)kGray[x];
+						kColumns[x] += kDifference >= 0 ? kDifference : -kDifference;
+					}
+				}
+			}
+
+			for (int bx = 0; bx < kBlocksX; bx++)
+			{
+				const int kX1 = (bx + 1)*block < kWidth ? (bx + 1)*block : kWidth;
+				D sum = 0;
+
+				for (int x = bx*block; x < kX1; x++)
+					sum += kColumns[x];
+
+				active(bx,by) = sum >= min_sum ? 1 : 0;
+				active_count += active(bx,by);
+			}
+		}
+	}
+
+	return active_count;
+}
+
+template void KrabsBoxDecimate<double>(const CImg<double>&, const int, CImg<double>&);
+template void KrabsBoxDecimate<unsigned char>(const CImg<unsigned char>&, const int, CImg<unsigned char>&);
+template void KrabsMotionMask<double>(const CImg<double>&, const CImg<double>&, const double, const int, CImg<unsigned char>&);
+template void KrabsMotionMask<unsigned char>(const CImg<unsigned char>&, const CImg<unsigned char>&, const double, const int, CImg<unsigned char>&);
+template void KrabsMotionMask<double>(const CImg<double>&, const CImg<double>&, const double, const int, const CImg<unsigned char>&, const int, CImg<unsigned char>&);
+template void KrabsMotionMask<unsigned char>(const CImg<unsigned char>&, const CImg<unsigned char>&, const double, const int, const CImg<unsigned char>&, const int, CImg<unsigned char>&);
+template int KrabsBlockMotion<double>(const CImg<double>&, const CImg<double>&, const int, const double, CImg<unsigned char>&);
+template int KrabsBlockMotion<unsigned char>(const CImg<unsigned char>&, const CImg<unsigned char>&, const int, const double, CImg<unsigned char>&);
+template void KrabsMotionMask<double>(const CImg<double>&, const CImg<double>&, const double, const int, const CImg<unsigned char>&, const int, const KrabsSpanMask&, CImg<unsigned char>&);
+template void KrabsMotionMask<unsigned char>(const CImg<unsigned char>&, const CImg<unsigned char>&, const double, const int, const CImg<unsigned char>&, const int, const KrabsSpanMask&, CImg<unsigned char>&);
+template int KrabsBlockMotion<double>(const CImg<double>&, const CImg<double>&, const int, const double, const KrabsSpanMask&, CImg<unsigned char>&);
+template int KrabsBlockMotion<unsigned char>(const CImg<unsigned char>&, const CImg<unsigned char>&, const int, const double, const KrabsSpanMask&, CImg<unsigned char>&);
@@ -0,0 +1,207 @@
+#ifndef CIMGTEST_LIB_KRABS_MOTION_H_
+#define CIMGTEST_LIB_KRABS_MOTION_H_
+
+#include "../CImg.h"
+#include "krabs_mask.h"
+#include "krabs_model_file.h"
+
+//! Background model used to split frames into foreground and background
+class KrabsBackgroundModel
+{
+public:
+	virtual ~KrabsBackgroundModel() {}
+
+	//! Seeds the model with the first frame
+	virtual void Initialize(const cimg_library::CImg<double> &gray) = 0;
+
+	//! Writes 1 where gray is foreground and 0 elsewhere, then learns gray
+	virtual void Apply(const cimg_library::CImg<double> &gray, cimg_library::CImg<double> &foreground) = 0;
+
+	//! 8-bit counterparts, used by the byte motion path. The model keeps separate state for each pixel type
+	virtual void Initialize(const cimg_library::CImg<unsigned char> &gray) = 0;
+	virtual void Apply(const cimg_library::CImg<unsigned char> &gray, cimg_library::CImg<unsigned char> &foreground) = 0;
+
+	//! Restores the state saved to filename in place of Initialize(gray)
+	/**
+	 * The model is seeded with gray instead when the file is missing, or was saved by another model, at another
+	 * frame size or from another pixel type.
+	 *
+	 * \return Whether the saved state was restored
+	 */
+	virtual bool Load(const char* filename, const cimg_library::CImg<double> &gray) = 0;
+	virtual bool Load(const char* filename, const cimg_library::CImg<unsigned char> &gray) = 0;
+
+	//! Copies the state to snapshot, for a KrabsModelWriter to save. Throws CImgArgumentException before the model is seeded
+	virtual void Snapshot(KrabsModelSnapshot &snapshot) const = 0;
+
+	//! Saves the state to filename as a KrabsModelFile. Throws CImgIOException when it cannot be written
+	void Save(const char* filename) const;
+
+	virtual bool is_initialized() const = 0;
+};
+
+//! Background model updated as an exponential running average
+/**
+ * background = (1 - learning_rate)*background + learning_rate*frame
+ *
+ * Keeps the model in step with slow lighting drift at the cost of one value per pixel.
+ * A learning rate of zero keeps the first frame as background.
+ *
+ * The 8-bit model stores the background as unsigned short in 8.8 fixed point and learns with a 12-bit rate: the
+ * learning rate is rounded to a multiple of 1/4096, and a positive rate below it learns at 1/4096.
+ */
+class KrabsRunningAverage : public KrabsBackgroundModel
+{
+public:
+	KrabsRunningAverage(const float learning_rate, const double threshold) : learning_rate_(learning_rate), threshold_(threshold) {}
+
+	void Initialize(const cimg_library::CImg<double> &gray);
+
+	//! Foreground is |background - gray| >= threshold, computed in the same pass that blends gray into the model
+	void Apply(const cimg_library::CImg<double> &gray, cimg_library::CImg<double> &foreground);
+
+	void Initialize(const cimg_library::CImg<unsigned char> &gray);
+	void Apply(const cimg_library::CImg<unsigned char> &gray, cimg_library::CImg<unsigned char> &foreground);
+
+	//! Each pixel type restores its own background, the 8-bit one when both were learned
+	bool Load(const char* filename, const cimg_library::CImg<double> &gray);
+	bool Load(const char* filename, const cimg_library::CImg<unsigned char> &gray);
+	void Snapshot(KrabsModelSnapshot &snapshot) const;
+
+	bool is_initialized() const { return !background_.is_empty() || !fixed_background_.is_empty(); }
+	const cimg_library::CImg<double>& background() const { return background_; }
+
+	//! 8-bit background, rounded from the fixed point model
+	void ByteBackground(cimg_library::CImg<unsigned char> &gray) const;
+
+private:
+	const float learning_rate_;
+	const double threshold_;
+	cimg_library::CImg<double> background_;
+	cimg_library::CImg<unsigned short> fixed_background_;
+};
+
+//! Mixture of gaussians background model
+/**
+ * Each pixel keeps kMixtureComponents gaussians. A pixel is background when it matches one of the
+ * gaussians that, ranked by weight/sigma, make up the first background_ratio of the total weight.
+ * Multi-modal backgrounds such as swaying trees or flicker are learned as extra modes instead of motion.
+ *
+ * Weights, means and variances are planar float buffers (one plane per component), so the per-pixel
+ * update is a branch-free kernel vectorized along each row, with rows processed in parallel.
+ *
+ * Source: P. KaewTraKulPong, R. Bowden, "An improved adaptive background mixture model for real-time tracking with shadow detection", 2001
+ */
+class KrabsGaussianMixture : public KrabsBackgroundModel
+{
+public:
+	static const int kMixtureComponents = 3;
+
+	explicit KrabsGaussianMixture(const float learning_rate, const float background_ratio=0.7f, const float match_sigmas=2.5f);
+
+	void Initialize(const cimg_library::CImg<double> &gray);
+	void Apply(const cimg_library::CImg<double> &gray, cimg_library::CImg<double> &foreground);
+	void Initialize(const cimg_library::CImg<unsigned char> &gray);
+	void Apply(const cimg_library::CImg<unsigned char> &gray, cimg_library::CImg<unsigned char> &foreground);
+
+	//! The mixture is kept as float for both pixel types, so either one restores it
+	bool Load(const char* filename, const cimg_library::CImg<double> &gray);
+	bool Load(const char* filename, const cimg_library::CImg<unsigned char> &gray);
+	void Snapshot(KrabsModelSnapshot &snapshot) const;
+
+	bool is_initialized() const { return !weights_.is_empty(); }
+
+private:
+	template<typename T> void Seed(const cimg_library::CImg<T> &gray);
+	template<typename T> bool Restore(const char* filename, const cimg_library::CImg<T> &gray);
+	template<typename T> void Update(const cimg_library::CImg<T> &gray, cimg_library::CImg<T> &foreground);
+
+	const float learning_rate_;
+	const float background_ratio_;
+	const float match_sigmas_;
+	cimg_library::CImg<float> weights_;
+	cimg_library::CImg<float> means_;
+	cimg_library::CImg<float> variances_;
+};
+
+//! 8-bit luminance of an RGB image, with integer weights
+/**
+ * gray = (77*R + 150*G + 29*B + 128) >> 8
+ */
+void KrabsLuminance(const cimg_library::CImg<double> &image, cimg_library::CImg<unsigned char> &gray);
+
+//! Decimates image by factor, averaging each factor x factor block of pixels
+/**
+ * Trailing rows and columns that do not fill a whole block are dropped. Defined for double and unsigned char.
+ */
+template<typename T>
+void KrabsBoxDecimate(const cimg_library::CImg<T> &image, const int factor, cimg_library::CImg<T> &decimated);
+
+//! Gaussian blur in 8.8 fixed point
+/**
+ * Separable kernel of radius 3*sigma with weights summing to 256, so each pass accumulates in unsigned short.
+ * Borders are replicated, like CImg blur with Neumann boundary conditions.
+ */
+void KrabsFixedBlur(cimg_library::CImg<unsigned char> &gray, const float sigma);
+
+//! Same as KrabsFixedBlur, blurring only the pixels included in spans
+/**
+ * Included pixels get the same values as with the whole frame blurred, excluded pixels keep theirs. The horizontal
+ * pass covers the included pixels of the rows within the kernel radius, so the cost follows the included area.
+ */
+void KrabsFixedBlur(cimg_library::CImg<unsigned char> &gray, const float sigma, const KrabsSpanMask &spans);
+
+//! Dilates a byte mask by a size x size square, leaving 1 where any pixel under the square is set
+/**
+ * The square spans the same pixels as CImg dilate(size): from x - size/2 to x + size - size/2 - 1.
+ * Rows and columns count the set pixels under a sliding window, so the cost does not depend on size.
+ */
+void KrabsDilateMask(cimg_library::CImg<unsigned char> &mask, const int size);
+
+//! Motion mask of gray against a reference frame, fused in one pass
+/**
+ * Same mask as (reference - gray).abs().threshold(threshold).dilate(dilate), as 0/1 bytes.
+ * Each row is differenced, thresholded and dilated horizontally while in cache, then counted into the
+ * vertical window, so reference and gray are read once and no intermediate image is allocated.
+ * Defined for double and unsigned char. Throws CImgArgumentException when reference and gray differ in size.
+ */
+template<typename T>
+void KrabsMotionMask(const cimg_library::CImg<T> &reference, const cimg_library::CImg<T> &gray, const double threshold, const int dilate, cimg_library::CImg<unsigned char> &mask);
+
+//! Same as KrabsMotionMask, thresholding only the blocks marked in active
+/**
+ * \param active Map of block x block tiles, as computed by KrabsBlockMotion. Pixels of inactive blocks are
+ *        taken as unchanged, so when active comes from KrabsBlockMotion with min_sum <= threshold the mask is exact.
+ */
+template<typename T>
+void KrabsMotionMask(const cimg_library::CImg<T> &reference, const cimg_library::CImg<T> &gray, const double threshold, const int dilate,
+	const cimg_library::CImg<unsigned char> &active, const int block, cimg_library::CImg<unsigned char> &mask);
+
+//! Same as KrabsMotionMask with active blocks, thresholding only the pixels included in spans
+/**
+ * Excluded pixels are taken as unchanged, and rows without included pixels are not read. Dilation still spreads
+ * motion of included pixels over the excluded ones next to them. An empty active map marks every block active.
+ * Spans and active must match the size of gray, or CImgArgumentException is thrown.
+ */
+template<typename T>
+void KrabsMotionMask(const cimg_library::CImg<T> &reference, const cimg_library::CImg<T> &gray, const double threshold, const int dilate,
+	const cimg_library::CImg<unsigned char> &active, const int block, const KrabsSpanMask &spans, cimg_library::CImg<unsigned char> &mask);
+
+//! Marks the blocks where gray differs from reference
+/**
+ * active(bx,by) is 1 when the sum of |reference - gray| over the block x block tile at (bx*block,by*block) is at
+ * least min_sum. Tiles at the right and bottom borders may be partial. Any pixel differing by min_sum or more
+ * makes its block active, so a frame without active blocks has an empty motion mask for thresholds >= min_sum.
+ * Throws CImgArgumentException when reference and gray, or spans and gray, differ in size.
+ *
+ * \return Number of active blocks, zero for a static frame
+ */
+template<typename T>
+int KrabsBlockMotion(const cimg_library::CImg<T> &reference, const cimg_library::CImg<T> &gray, const int block, const double min_sum, cimg_library::CImg<unsigned char> &active);
+
+//! Same as KrabsBlockMotion, summing only the differences of the pixels included in spans
+template<typename T>
+int KrabsBlockMotion(const cimg_library::CImg<T> &reference, const cimg_library::CImg<T> &gray, const int block, const double min_sum,
+	const KrabsSpanMask &spans, cimg_library::CImg<unsigned char> &active);
+
+#endif // CIMGTEST_LIB_KRABS_MOTION_H_
@@ -0,0 +1,49 @@
+#include "krabs_pacer.h"
+
+#include <thread>
+
+using namespace std;
+
+const chrono::milliseconds kFpsWindow(1000);
+
+KrabsFramePacer::KrabsFramePacer(const double target_fps) :
+	period_(target_fps > 0 ? chrono::duration_cast<Clock::duration>(chrono::duration<double>(1/target_fps)) : Clock::duration::zero()),
+	deadline_(Clock::now() + period_), start_(Clock::now()), window_start_(start_), window_frames_(0), frames_(0), late_(0), fps_(0)
+{
+}
+
+void KrabsFramePacer::Wait()
+{
+	Clock::time_point now = Clock::now();
+
+	if (period_ > Clock::duration::zero())
+	{
+		if (now <= deadline_)
+		{
+			this_thread::sleep_until(deadline_);
+			now = deadline_;
+		}
+		else
+		{
+			late_++;
+			deadline_ = now;
+		}
+		deadline_ += period_;
+	}
+
+	frames_++;
+	window_frames_++;
+
+	if (now - window_start_ >= kFpsWindow)
+	{
+		fps_ = window_frames_/chrono::duration<double>(now - window_start_).count();
+		window_start_ = now;
+		window_frames_ = 0;
+	}
+}
+
+double KrabsFramePacer::average_fps() const
+{
+	const double kSeconds = chrono::duration<double>(Clock::now() - start_).count();
+	return kSeconds > 0 ? frames_/kSeconds : 0;
+}
@@ -0,0 +1,44 @@
+#ifndef CIMGTEST_LIB_KRABS_PACER_H_
+#define CIMGTEST_LIB_KRABS_PACER_H_
+
+#include <chrono>
+
+//! Paces a frame loop to a target frame rate, and measures the rate achieved
+/**
+ * Each frame has a deadline one period after the previous one. Wait sleeps until the deadline when the frame was
+ * done early. A frame done after its deadline is counted as late, and the next deadline starts from it, so a slow
+ * frame is not followed by a burst of frames catching up.
+ *
+ * A target of 0 runs as fast as possible, only measuring the rate.
+ */
+class KrabsFramePacer
+{
+public:
+	explicit KrabsFramePacer(const double target_fps);
+
+	//! Ends the current frame, waiting for its deadline
+	void Wait();
+
+	//! Frames per second over the last second or so
+	double fps() const { return fps_; }
+
+	//! Frames per second since the first frame
+	double average_fps() const;
+
+	unsigned long frames() const { return frames_; }
+	unsigned long late() const { return late_; }
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	const Clock::duration period_;
+	Clock::time_point deadline_;
+	Clock::time_point start_;
+	Clock::time_point window_start_;
+	unsigned long window_frames_;
+	unsigned long frames_;
+	unsigned long late_;
+	double fps_;
+};
+
+#endif // CIMGTEST_LIB_KRABS_PACER_H_
@@ -0,0 +1,126 @@
+#ifndef CIMGTEST_LIB_KRABS_PIPELINE_H_
+#define CIMGTEST_LIB_KRABS_PIPELINE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+//! Blocking queue holding at most capacity items
+/**
+ * Push waits while the queue is full and Pop waits while it is empty, so a slow consumer holds back its producer
+ * instead of letting items pile up. Once closed, Push fails and Pop drains the remaining items.
+ */
+template<typename T>
+class KrabsBoundedQueue
+{
+public:
+	explicit KrabsBoundedQueue(const size_t capacity) : capacity_(capacity), closed_(false) {}
+
+	//! Returns false when the queue was closed
+	bool Push(const T &item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+		if (closed_)
+			return false;
+
+		items_.push_back(item);
+		not_empty_.notify_one();
+		return true;
+	}
+
+	//! Returns false when the queue was closed and is empty
+	bool Pop(T &item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+		if (items_.empty())
+			return false;
+
+		item = items_.front();
+		items_.pop_front();
+		not_full_.notify_one();
+		return true;
+	}
+
+	void Close()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		closed_ = true;
+		not_empty_.notify_all();
+		not_full_.notify_all();
+	}
+
+private:
+	const size_t capacity_;
+	bool closed_;
+	std::deque<T> items_;
+	std::mutex mutex_;
+	std::condition_variable not_empty_;
+	std::condition_variable not_full_;
+};
+
+//! Worker thread running one step of a pipeline
+/**
+ * Pops items from input, runs work on them and pushes them to output, in order. When input is closed and drained,
+ * work returns false at the end of the stream, or work throws, output is closed so the stages downstream finish as well.
+ */
+template<typename T>
+class KrabsPipelineStage
+{
+public:
+	KrabsPipelineStage(KrabsBoundedQueue<T> &input, KrabsBoundedQueue<T> &output, const std::function<bool(T&)> &work) :
+		input_(input), output_(output), work_(work) {}
+
+	~KrabsPipelineStage()
+	{
+		if (thread_.joinable())
+			thread_.join();
+	}
+
+	void Start()
+	{
+		thread_ = std::thread(&KrabsPipelineStage::Run, this);
+	}
+
+	//! Waits for the stage to finish, and rethrows the error that stopped it
+	void Join()
+	{
+		if (thread_.joinable())
+			thread_.join();
+		if (error_)
+			std::rethrow_exception(error_);
+	}
+
+private:
+	void Run()
+	{
+		try
+		{
+			T item;
+			while (input_.Pop(item))
+			{
+				if (!work_(item) || !output_.Push(item))
+					break;
+			}
+		}
+		catch (...)
+		{
+			error_ = std::current_exception();
+			input_.Close();
+		}
+
+		output_.Close();
+	}
+
+	KrabsBoundedQueue<T> &input_;
+	KrabsBoundedQueue<T> &output_;
+	const std::function<bool(T&)> work_;
+	std::thread thread_;
+	std::exception_ptr error_;
+};
+
+#endif // CIMGTEST_LIB_KRABS_PIPELINE_H_
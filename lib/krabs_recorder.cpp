@@ -0,0 +1,192 @@
+#include "krabs_recorder.h"
+#include "krabs_convert.h"
+
+#include <chrono>
+#include <cstdio>
+
+using namespace cimg_library;
+using namespace std;
+
+const int kJpegQuality = 90;
+
+KrabsClipRecorder::KrabsClipRecorder(const char* prefix, const unsigned int pre_frames, const unsigned int post_frames, const Format format) :
+	prefix_(prefix), pre_frames_(pre_frames), post_frames_(post_frames), format_(format),
+	busy_(new atomic<bool>[2*pre_frames + 2]), next_(0), filled_(0), post_left_(0), clip_(0), clips_(0), dropped_(0), closing_(false)
+{
+	// the ring keeps pre_frames frames plus the current one, and as many again for the writer to catch up
+
+	slots_.resize(2*pre_frames + 2);
+	for (size_t i = 0; i < slots_.size(); i++)
+		busy_[i] = false;
+
+	thread_ = thread(&KrabsClipRecorder::Run, this);
+}
+
+KrabsClipRecorder::~KrabsClipRecorder()
+{
+	{
+		lock_guard<mutex> lock(mutex_);
+		if (post_left_)
+			jobs_.push_back({kEndClip, clip_});
+		closing_ = true;
+	}
+	wake_.notify_one();
+	thread_.join();
+}
+
+void KrabsClipRecorder::Push(const CImg<double> &frame, const bool motion)
+{
+	const unsigned int kSlots = slots_.size();
+	const unsigned int kSlot = next_;
+
+	if (slots_[0].is_empty())
+		for (CImg<unsigned char> &slot : slots_)
+			slot.assign(3, frame.width(), frame.height());
+	else if (slots_[0].height() != frame.width() || slots_[0].depth() != frame.height())
+		throw CImgArgumentException("KrabsClipRecorder: Frame size %dx%d differs from the clip size %dx%d.",
+			frame.width(), frame.height(), slots_[0].height(), slots_[0].depth());
+
+	// a slot still waiting for the writer is not overwritten: the frame is dropped instead
+
+	const bool kStored = !busy_[kSlot].load(memory_order_acquire);
+	if (kStored)
+	{
+		const int kLast = frame.spectrum() - 1;
+		const double *const kRed   = frame.data(0,0,0,0);
+		const double *const kGreen = frame.data(0,0,0,kLast < 1 ? kLast : 1);
+		const double *const kBlue  = frame.data(0,0,0,kLast < 2 ? kLast : 2);
+		const long kSize = (long)frame.width()*frame.height();
+		unsigned char *const kSlotData = slots_[kSlot].data();
+
+		#pragma omp parallel for if (kSize >= 65536)
+		for (long i = 0; i < kSize; i++)
+		{
+			kSlotData[3*i]     = (unsigned char)(kRed[i]   < 0 ? 0 : kRed[i]   > 255 ? 255 : kRed[i]);
+			kSlotData[3*i + 1] = (unsigned char)(kGreen[i] < 0 ? 0 : kGreen[i] > 255 ? 255 : kGreen[i]);
+			kSlotData[3*i + 2] = (unsigned char)(kBlue[i]  < 0 ? 0 : kBlue[i]  > 255 ? 255 : kBlue[i]);
+		}
+
+		next_ = (kSlot + 1)%kSlots;
+	}
+	else
+		dropped_.fetch_add(1, memory_order_relaxed);
+
+	if (motion)
+	{
+		if (!post_left_)
+		{
+			// new clip, opened with the frames kept before this one, oldest first
+
+			clip_ = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+			clips_++;
+
+			const unsigned int kPreRoll = filled_ < pre_frames_ ? filled_ : pre_frames_;
+			for (unsigned int i = kPreRoll; i > 0; i--)
+			{
+				const unsigned int kPrevious = (kSlot + kSlots - i)%kSlots;
+				if (!busy_[kPrevious].load(memory_order_acquire))
+					Queue(kPrevious);
+			}
+		}
+
+		post_left_ = post_frames_ + 1;
+	}
+
+	if (kStored && filled_ < kSlots)
+		filled_++;
+
+	if (!post_left_)
+		return;
+
+	if (kStored)
+		Queue(kSlot);
+
+	if (--post_left_ == 0)
+	{
+		{
+			lock_guard<mutex> lock(mutex_);
+			jobs_.push_back({kEndClip, clip_});
+		}
+		wake_.notify_one();
+	}
+}
+
+void KrabsClipRecorder::Queue(const int slot)
+{
+	busy_[slot].store(true, memory_order_release);
+	{
+		lock_guard<mutex> lock(mutex_);
+		jobs_.push_back({slot, clip_});
+	}
+	wake_.notify_one();
+}
+
+void KrabsClipRecorder::Run()
+{
+	FILE* file = 0;
+	unsigned long frame = 0;
+
+	unique_lock<mutex> lock(mutex_);
+	for (;;)
+	{
+		wake_.wait(lock, [this] { return closing_ || !jobs_.empty(); });
+
+		if (jobs_.empty())
+			break;
+
+		const Job kJob = jobs_.front();
+		jobs_.pop_front();
+		lock.unlock();
+
+		Write(kJob, file, frame);
+
+		lock.lock();
+	}
+
+	if (file)
+		fclose(file);
+}
+
+void KrabsClipRecorder::Write(const Job &job, FILE* &file, unsigned long &frame)
+{
+	if (job.slot == kEndClip)
+	{
+		if (file)
+			fclose(file);
+		file = 0;
+		frame = 0;
+		return;
+	}
+
+	const CImg<unsigned char> &kSlot = slots_[job.slot];
+	char filename[1024];
+
+	if (format_ == kJpeg)
+	{
+		snprintf(filename, sizeof(filename), "%s_%lld_%05lu.jpg", prefix_.c_str(), job.clip, frame);
+		try
+		{
+			CImg<unsigned char> planar;
+			KrabsDeinterleave(kSlot.data(), kSlot.height(), kSlot.depth(), 3L*kSlot.height(), kRgbOrder, planar);
+			planar.save_jpeg(filename, kJpegQuality);
+		}
+		catch (CImgException&)
+		{
+			dropped_.fetch_add(1, memory_order_relaxed);
+		}
+	}
+	else
+	{
+		if (!file && frame == 0)
+		{
+			snprintf(filename, sizeof(filename), "%s_%lld_%dx%d.rgb", prefix_.c_str(), job.clip, kSlot.height(), kSlot.depth());
+			file = fopen(filename, "wb");
+		}
+
+		if (!file || fwrite(kSlot.data(), 1, kSlot.size(), file) != kSlot.size())
+			dropped_.fetch_add(1, memory_order_relaxed);
+	}
+
+	frame++;
+	busy_[job.slot].store(false, memory_order_release);
+}
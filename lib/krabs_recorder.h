@@ -0,0 +1,80 @@
+#ifndef CIMGTEST_LIB_KRABS_RECORDER_H_
+#define CIMGTEST_LIB_KRABS_RECORDER_H_
+
+#include "../CImg.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//! Saves clips around motion: the frames before it, the frames with motion and the frames after it
+/**
+ * Every frame is copied as interleaved 8-bit RGB into a ring, allocated on the first frame, which always holds the
+ * last pre_frames frames. Frames must all have the size of the first one. When motion starts, a clip is opened with
+ * those frames, then each frame is added until post_frames frames passed without motion.
+ *
+ * The frames of a clip are handed by ring slot to a writer thread, which saves them while the ring keeps turning:
+ * the ring has room for pre_frames more frames than it must keep, and a frame landing on a slot the writer did not
+ * save yet is dropped instead of waiting, so Push never waits on the disk.
+ *
+ * Clips are written to prefix_<timestamp>_<width>x<height>.rgb as raw rgb24 frames, readable by e.g.
+ * ffmpeg -f rawvideo -pix_fmt rgb24 -s <width>x<height>, or as prefix_<timestamp>_<frame>.jpg images.
+ */
+class KrabsClipRecorder
+{
+public:
+	enum Format { kRaw, kJpeg };
+
+	KrabsClipRecorder(const char* prefix, const unsigned int pre_frames, const unsigned int post_frames, const Format format = kRaw);
+
+	//! Writes the pending frames and closes the open clip
+	~KrabsClipRecorder();
+
+	//! Adds a frame, with motion or not, from the capture or processing thread
+	void Push(const cimg_library::CImg<double> &frame, const bool motion);
+
+	unsigned long clips() const { return clips_; }
+	unsigned long dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+	//! Slot to write, or kEndClip
+	struct Job
+	{
+		int slot;
+		long long clip;
+	};
+
+	static const int kEndClip = -1;
+
+	void Queue(const int slot);
+	void Run();
+	void Write(const Job &job, std::FILE* &file, unsigned long &frame);
+
+	const std::string prefix_;
+	const unsigned int pre_frames_;
+	const unsigned int post_frames_;
+	const Format format_;
+
+	// loop side
+	std::vector<cimg_library::CImg<unsigned char>> slots_; // 3 x width x height buffers, interleaved RGB rows
+	std::unique_ptr<std::atomic<bool>[]> busy_;           // set while a slot waits for the writer
+	unsigned int next_;
+	unsigned int filled_;
+	unsigned int post_left_;
+	long long clip_;
+	unsigned long clips_;
+	std::atomic<unsigned long> dropped_;
+
+	// writer side
+	std::deque<Job> jobs_;
+	bool closing_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::thread thread_;
+};
+
+#endif // CIMGTEST_LIB_KRABS_RECORDER_H_
@@ -0,0 +1,222 @@
+#include "krabs_regions.h"
+
+#include <algorithm>
+
+using namespace std;
+
+const double kGlyphFraction = 0.25;  // a suppressed nested box covers at most this fraction of its container
+const int kButtonArea = 20000;      // a container suppresses nested boxes when its box spans at most this many pixels
+
+//! Uniform grid over region boxes
+class RegionGrid
+{
+public:
+	RegionGrid(const int x0, const int y0, const int x1, const int y1, const int cell_size) :
+		x0_(x0), y0_(y0), cell_size_(cell_size),
+		columns_((x1 - x0)/cell_size + 1), rows_((y1 - y0)/cell_size + 1),
+		cells_(columns_*rows_) {}
+
+	void Insert(const KrabsRegion &region, const int index)
+	{
+		for (int row = Row(region.y0); row <= Row(region.y1); row++)
+			for (int column = Column(region.x0); column <= Column(region.x1); column++)
+				cells_[row*columns_ + column].push_back(index);
+	}
+
+	//! Adds index to the cells grown covers and previous did not, previous lying inside grown
+	void Grow(const KrabsRegion &previous, const KrabsRegion &grown, const int index)
+	{
+		for (int row = Row(grown.y0); row <= Row(grown.y1); row++)
+			for (int column = Column(grown.x0); column <= Column(grown.x1); column++)
+				if (row < Row(previous.y0) || row > Row(previous.y1) || column < Column(previous.x0) || column > Column(previous.x1))
+					cells_[row*columns_ + column].push_back(index);
+	}
+
+	//! Appends to candidates every index stored in the cells overlapped by region, once
+	void Query(const KrabsRegion &region, vector<int> &stamps, const int stamp, vector<int> &candidates) const
+	{
+		for (int row = Row(region.y0); row <= Row(region.y1); row++)
+			for (int column = Column(region.x0); column <= Column(region.x1); column++)
+				for (int index : cells_[row*columns_ + column])
+					if (stamps[index] != stamp)
+					{
+						stamps[index] = stamp;
+						candidates.push_back(index);
+					}
+	}
+
+private:
+	int Column(const int x) const { return (x - x0_)/cell_size_; }
+	int Row(const int y) const { return (y - y0_)/cell_size_; }
+
+	const int x0_;
+	const int y0_;
+	const int cell_size_;
+	const int columns_;
+	const int rows_;
+	vector<vector<int>> cells_;
+};
+
+static int BoxArea(const KrabsRegion &region)
+{
+	return (region.x1 - region.x0 + 1)*(region.y1 - region.y0 + 1);
+}
+
+double KrabsIoU(const KrabsRegion &a, const KrabsRegion &b)
+{
+	const int kWidth  = min(a.x1, b.x1) - max(a.x0, b.x0) + 1;
+	const int kHeight = min(a.y1, b.y1) - max(a.y0, b.y0) + 1;
+
+	if (kWidth <= 0 || kHeight <= 0)
+		return 0;
+
+	const double kIntersection = (double)kWidth*kHeight;
+	return kIntersection/(BoxArea(a) + BoxArea(b) - kIntersection);
+}
+
+bool KrabsContains(const KrabsRegion &outer, const KrabsRegion &inner)
+{
+	return inner.x0 >= outer.x0 && inner.x1 <= outer.x1 && inner.y0 >= outer.y0 && inner.y1 <= outer.y1;
+}
+
+void KrabsMergeRegions(vector<KrabsRegion> &regions, const double iou_threshold, const bool suppress_nested)
+{
+	if (regions.size() < 2 || (iou_threshold >= 1 && !suppress_nested))
+		return;
+
+	sort(regions.begin(), regions.end(), [](const KrabsRegion &a, const KrabsRegion &b) { return BoxArea(a) > BoxArea(b); });
+
+	// grid cells sized after the median region side, so most regions overlap a few cells
+
+	KrabsRegion bounds;
+	vector<int> sides;
+	sides.reserve(regions.size());
+
+	for (const KrabsRegion &region : regions)
+	{
+		bounds.x0 = min(bounds.x0, region.x0);
+		bounds.y0 = min(bounds.y0, region.y0);
+		bounds.x1 = max(bounds.x1, region.x1);
+		bounds.y1 = max(bounds.y1, region.y1);
+		sides.push_back(max(region.x1 - region.x0, region.y1 - region.y0) + 1);
+	}
+
+	nth_element(sides.begin(), sides.begin() + sides.size()/2, sides.end());
+	RegionGrid grid(bounds.x0, bounds.y0, bounds.x1, bounds.y1, max(sides[sides.size()/2], 8));
+
+	// only a button sized box drops the glyph sized boxes inside it, so a frame or a panel outline keeps its buttons
+
+	const auto kNested = [&](const KrabsRegion &outer, const KrabsRegion &inner) {
+		return suppress_nested && KrabsContains(outer, inner) && BoxArea(inner) <= kGlyphFraction*BoxArea(outer) &&
+			BoxArea(outer) <= kButtonArea;
+	};
+
+	vector<KrabsRegion> kept;
+	vector<bool> alive;
+	vector<int> stamps;
+	vector<int> candidates;
+	int stamp = 0;
+
+	for (size_t i = 0; i < regions.size(); i++)
+	{
+		const KrabsRegion &kRegion = regions[i];
+
+		candidates.clear();
+		grid.Query(kRegion, stamps, stamp++, candidates);
+
+		int merge_into = -1;
+		bool suppressed = false;
+
+		for (int index : candidates)
+		{
+			if (!alive[index])
+				continue;
+
+			if (kNested(kept[index], kRegion))
+			{
+				suppressed = true;
+				break;
+			}
+
+			if (merge_into < 0 && KrabsIoU(kept[index], kRegion) > iou_threshold)
+				merge_into = index;
+		}
+
+		if (suppressed)
+			continue;
+
+		if (merge_into < 0)
+		{
+			kept.push_back(kRegion);
+			alive.push_back(true);
+			stamps.push_back(-1);
+			grid.Insert(kRegion, (int)kept.size()-1);
+			continue;
+		}
+
+		KrabsRegion &target = kept[merge_into];
+		KrabsRegion previous = target;
+		target.x0 = min(target.x0, kRegion.x0);
+		target.y0 = min(target.y0, kRegion.y0);
+		target.x1 = max(target.x1, kRegion.x1);
+		target.y1 = max(target.y1, kRegion.y1);
+		target.pixels += kRegion.pixels;
+		grid.Grow(previous, target, merge_into);
+
+		// the grown box may now overlap or hold boxes kept before it, so it absorbs them until it stops growing
+
+		for (bool grown = true; grown && alive[merge_into];)
+		{
+			grown = false;
+			previous = target;
+			candidates.clear();
+			grid.Query(target, stamps, stamp++, candidates);
+
+			for (int index : candidates)
+			{
+				if (index == merge_into || !alive[index])
+					continue;
+
+				KrabsRegion &other = kept[index];
+				if (KrabsIoU(other, target) > iou_threshold)
+				{
+					target.x0 = min(target.x0, other.x0);
+					target.y0 = min(target.y0, other.y0);
+					target.x1 = max(target.x1, other.x1);
+					target.y1 = max(target.y1, other.y1);
+					target.pixels += other.pixels;
+					alive[index] = false;
+					grown = true;
+				}
+				else if (kNested(target, other))
+					alive[index] = false;
+				else if (kNested(other, target))
+				{
+					alive[merge_into] = false;
+					break;
+				}
+			}
+
+			if (grown)
+				grid.Grow(previous, target, merge_into);
+		}
+	}
+
+	regions.clear();
+	for (size_t i = 0; i < kept.size(); i++)
+		if (alive[i])
+			regions.push_back(kept[i]);
+
+	// merges may have grown a box past larger ones
+
+	stable_sort(regions.begin(), regions.end(), [](const KrabsRegion &a, const KrabsRegion &b) { return BoxArea(a) > BoxArea(b); });
+}
+
+void KrabsScaleRegion(KrabsRegion &region, const int factor, const int width, const int height)
+{
+	region.x0 = min(region.x0*factor, width - 1);
+	region.y0 = min(region.y0*factor, height - 1);
+	region.x1 = min(region.x1*factor + factor - 1, width - 1);
+	region.y1 = min(region.y1*factor + factor - 1, height - 1);
+	region.pixels *= factor*factor;
+}
@@ -0,0 +1,39 @@
+#ifndef CIMGTEST_LIB_KRABS_REGIONS_H_
+#define CIMGTEST_LIB_KRABS_REGIONS_H_
+
+#include "krabs.h"
+#include <vector>
+
+//! Intersection over union of two regions
+/**
+ * Regions are taken as pixel boxes including their x1 and y1 borders.
+ */
+double KrabsIoU(const KrabsRegion &a, const KrabsRegion &b);
+
+//! Tells if inner lies entirely inside outer
+bool KrabsContains(const KrabsRegion &outer, const KrabsRegion &inner);
+
+//! Merges overlapping regions and suppresses nested ones
+/**
+ * \param regions Regions to filter. They are replaced by the kept regions, largest first. Merged regions add up their pixels.
+ * \param iou_threshold A region whose IoU with a kept region is above it is merged into the kept region box, 1 or more merges none
+ * \param suppress_nested Drops regions that lie entirely inside a kept region, e.g. the glyphs inside a button outline.
+ *        Only glyph sized regions, at most a quarter of the kept box, inside a button sized box, at most 20000 pixels,
+ *        are dropped, so an image border or a keyboard outline does not hide what it holds
+ *
+ * With no merge and no suppression asked, regions are left as they are, in their order.
+ *
+ * Regions are visited from the largest to the smallest and matched only against the kept regions that share a
+ * cell of a uniform grid, so the pass costs O(n log n) for the sort plus the grid lookups. A box grown by a merge is
+ * checked again against the kept boxes, and takes in the ones it now overlaps.
+ */
+void KrabsMergeRegions(std::vector<KrabsRegion> &regions, const double iou_threshold, const bool suppress_nested=false);
+
+//! Maps a region found on an image decimated by factor back to the full resolution image
+/**
+ * Each decimated pixel covers factor x factor pixels, so the box grows to include all of them,
+ * then it is clipped to width x height. The pixel count is scaled the same way.
+ */
+void KrabsScaleRegion(KrabsRegion &region, const int factor, const int width, const int height);
+
+#endif // CIMGTEST_LIB_KRABS_REGIONS_H_
@@ -0,0 +1,270 @@
+#include "krabs_source.h"
+#include "krabs_convert.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+using namespace cimg_library;
+using namespace std;
+
+const char* const kImageExtensions[] = {"png", "jpg", "jpeg", "bmp", "ppm", "pgm", "pnm", "tif", "tiff"};
+const int kTextureCell = 16;         // synthetic background noise is smoothed over cells of this side
+const unsigned int kNoiseSize = 1 << 16;
+const double kNoiseAmplitude = 3;
+const unsigned long kSyntheticFrames = 300;
+const unsigned int kSyntheticSeed = 1;
+
+//! Lower case extension of filename, empty when it has none
+static string Extension(const string& filename)
+{
+	const size_t kDot = filename.find_last_of("./");
+	if (kDot == string::npos || filename[kDot] != '.')
+		return string();
+
+	string extension = filename.substr(kDot + 1);
+	for (char &c : extension)
+		c = (char)tolower(c);
+	return extension;
+}
+
+KrabsImageSequence::KrabsImageSequence(const char* directory) :
+	next_(0), width_(0), height_(0)
+{
+	const CImgList<char> kFiles = cimg::files(directory, false, 0, true);
+
+	for (const CImg<char> &file : kFiles)
+	{
+		const string kFile(file.data());
+		const string kExtension = Extension(kFile);
+
+		for (const char *const kImageExtension : kImageExtensions)
+			if (kExtension == kImageExtension)
+			{
+				files_.push_back(kFile);
+				break;
+			}
+	}
+
+	if (files_.empty())
+		throw CImgIOException("KrabsImageSequence: No image found in directory '%s'.", directory);
+}
+
+bool KrabsImageSequence::Grab(CImg<double>& frame, const unsigned int skip_frames)
+{
+	next_ += skip_frames;
+	if (next_ >= files_.size())
+		return false;
+
+	frame.load(files_[next_++].c_str());
+
+	// gray images get three equal channels and alpha is dropped, then every frame takes the size of the first
+
+	if (frame.spectrum() == 1)
+		frame.resize(-100, -100, -100, 3);
+	else if (frame.spectrum() > 3)
+		frame.channels(0, 2);
+
+	if (!width_)
+	{
+		width_ = frame.width();
+		height_ = frame.height();
+	}
+	else if (!frame.is_sameXY(width_, height_))
+		frame.resize(width_, height_, 1, 3, 3);
+	return true;
+}
+
+KrabsRawVideo::KrabsRawVideo(const char* filename, const int width, const int height) :
+	file_(0), owns_file_(false)
+{
+	// an empty frame would read zero bytes forever
+
+	if (width <= 0 || height <= 0)
+		throw CImgArgumentException("KrabsRawVideo: Invalid frame size %dx%d for raw video file '%s'.", width, height, filename);
+	buffer_.assign(3, width, height);
+
+	if (!strcmp(filename, "-"))
+		file_ = stdin;
+	else
+	{
+		file_ = fopen(filename, "rb");
+		owns_file_ = true;
+	}
+
+	if (!file_)
+		throw CImgIOException("KrabsRawVideo: Failed to open raw video file '%s'.", filename);
+}
+
+KrabsRawVideo::~KrabsRawVideo()
+{
+	Release();
+}
+
+bool KrabsRawVideo::Read(const unsigned int skip_frames)
+{
+	if (!file_)
+		return false;
+
+	// a frame cut short ends the video
+
+	for (unsigned int i = 0; i <= skip_frames; i++)
+		if (fread(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size())
+			return false;
+	return true;
+}
+
+bool KrabsRawVideo::Grab(CImg<double>& frame, const unsigned int skip_frames)
+{
+	if (!Read(skip_frames))
+		return false;
+
+	KrabsDeinterleave(buffer_.data(), buffer_.height(), buffer_.depth(), 3L*buffer_.height(), kRgbOrder, frame);
+	return true;
+}
+
+bool KrabsRawVideo::GrabGray(CImg<unsigned char>& gray, const unsigned int skip_frames)
+{
+	if (!Read(skip_frames))
+		return false;
+
+	KrabsInterleavedLuminance(buffer_.data(), buffer_.height(), buffer_.depth(), 3L*buffer_.height(), kRgbOrder, gray);
+	return true;
+}
+
+void KrabsRawVideo::Release()
+{
+	if (file_ && owns_file_)
+		fclose(file_);
+	file_ = 0;
+}
+
+KrabsSyntheticSource::KrabsSyntheticSource(const int width, const int height, const unsigned long frames, const unsigned int seed, const int shapes) :
+	random_(seed), frames_(frames), frame_(0), ended_(false)
+{
+	// values are taken from the raw generator output, whose sequence the standard fixes, unlike the distributions
+
+	const auto kUniform = [this](const double low, const double high) { return low + (high - low)*(random_()/4294967296.0); };
+
+	background_.assign(width/kTextureCell + 2, height/kTextureCell + 2, 1, 3);
+	for (double &value : background_)
+		value = kUniform(40, 215);
+	background_.resize(width, height, 1, 3, 3);
+
+	noise_.resize(kNoiseSize);
+	for (double &value : noise_)
+		value = kUniform(-kNoiseAmplitude, kNoiseAmplitude);
+
+	for (int i = 0; i < shapes; i++)
+	{
+		Shape shape;
+		shape.half_width = (int)kUniform(width/32 + 1, width/10 + 2);
+		shape.half_height = (int)kUniform(height/32 + 1, height/10 + 2);
+		shape.x = kUniform(shape.half_width, width - shape.half_width);
+		shape.y = kUniform(shape.half_height, height - shape.half_height);
+		shape.vx = kUniform(1, 6)*(random_() & 1 ? 1 : -1);
+		shape.vy = kUniform(1, 6)*(random_() & 1 ? 1 : -1);
+		for (double &channel : shape.color)
+			channel = kUniform(0, 255);
+		shape.ellipse = (random_() & 1) != 0;
+		shapes_.push_back(shape);
+	}
+}
+
+void KrabsSyntheticSource::Move()
+{
+	const int kWidth = background_.width();
+	const int kHeight = background_.height();
+
+	for (Shape &shape : shapes_)
+	{
+		shape.x += shape.vx;
+		shape.y += shape.vy;
+
+		if (shape.x < shape.half_width || shape.x > kWidth - 1 - shape.half_width)
+		{
+			shape.x = shape.x < shape.half_width ? shape.half_width : kWidth - 1 - shape.half_width;
+			shape.vx = -shape.vx;
+		}
+		if (shape.y < shape.half_height || shape.y > kHeight - 1 - shape.half_height)
+		{
+			shape.y = shape.y < shape.half_height ? shape.half_height : kHeight - 1 - shape.half_height;
+			shape.vy = -shape.vy;
+		}
+	}
+
+	frame_++;
+}
+
+bool KrabsSyntheticSource::Grab(CImg<double>& frame, const unsigned int skip_frames)
+{
+	for (unsigned int i = 0; i < skip_frames && !(frames_ && frame_ >= frames_); i++)
+		Move();
+
+	if (ended_ || (frames_ && frame_ >= frames_))
+		return false;
+
+	frame = background_;
+
+	for (const Shape &shape : shapes_)
+	{
+		const int kX = (int)shape.x;
+		const int kY = (int)shape.y;
+
+		if (shape.ellipse)
+			frame.draw_ellipse(kX, kY, (float)shape.half_width, (float)shape.half_height, 0, shape.color);
+		else
+			frame.draw_rectangle(kX - shape.half_width, kY - shape.half_height, kX + shape.half_width, kY + shape.half_height, shape.color);
+	}
+
+	// noise is read from a fixed table at an offset drawn for each frame
+
+	const unsigned int kOffset = random_() & (kNoiseSize - 1);
+	const long kSize = (long)frame.size();
+	const double *const kNoise = noise_.data();
+	double *const kFrame = frame.data();
+
+	for (long i = 0; i < kSize; i++)
+	{
+		const double kValue = kFrame[i] + kNoise[(kOffset + i) & (kNoiseSize - 1)];
+		kFrame[i] = kValue < 0 ? 0 : (kValue > 255 ? 255 : kValue);
+	}
+
+	Move();
+	return true;
+}
+
+unique_ptr<KrabsFrameSource> KrabsOpenFrameSource(const char* name, const int width, const int height)
+{
+	const string kName(name);
+
+	if (!kName.empty() && kName.find_first_not_of("0123456789") == string::npos)
+		return unique_ptr<KrabsFrameSource>(new KrabsCamera(atoi(name), width, height));
+
+	if (kName.compare(0, 9, "synthetic") == 0 && (kName.size() == 9 || kName[9] == ':'))
+	{
+		unsigned long frames = kSyntheticFrames;
+		unsigned int seed = kSyntheticSeed;
+		sscanf(name, "synthetic:%lu:%u", &frames, &seed);
+		return unique_ptr<KrabsFrameSource>(new KrabsSyntheticSource(width, height, frames, seed));
+	}
+
+	if (cimg::is_directory(name))
+		return unique_ptr<KrabsFrameSource>(new KrabsImageSequence(name));
+
+	if (kName == "-" || Extension(kName) == "rgb")
+	{
+		// recorded clips are named <prefix>_<timestamp>_<width>x<height>.rgb
+
+		int raw_width = width, raw_height = height;
+		const size_t kSize = kName.find_last_of('_');
+		if (kSize != string::npos && sscanf(name + kSize + 1, "%dx%d.", &raw_width, &raw_height) != 2)
+		{
+			raw_width = width;
+			raw_height = height;
+		}
+		return unique_ptr<KrabsFrameSource>(new KrabsRawVideo(name, raw_width, raw_height));
+	}
+
+	return unique_ptr<KrabsFrameSource>(new KrabsCamera(name));
+}
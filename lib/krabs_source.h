@@ -0,0 +1,114 @@
+#ifndef CIMGTEST_LIB_KRABS_SOURCE_H_
+#define CIMGTEST_LIB_KRABS_SOURCE_H_
+
+#include "krabs_capture.h"
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+//! Images of a directory, read in file name order
+/**
+ * Files with an image extension CImg reads (png, jpg, jpeg, bmp, ppm, pgm, pnm, tif, tiff) are taken, anything
+ * else in the directory is left out. Frames are RGB at the size of the first image: gray images are spread over the
+ * three channels, alpha is dropped and images of another size are resized with linear interpolation.
+ */
+class KrabsImageSequence : public KrabsFrameSource
+{
+public:
+	explicit KrabsImageSequence(const char* directory);
+
+	bool Grab(cimg_library::CImg<double>& frame, const unsigned int skip_frames = 0);
+	void Release() { next_ = files_.size(); }
+	bool is_live() const { return false; }
+
+	size_t size() const { return files_.size(); }
+
+private:
+	std::vector<std::string> files_;
+	size_t next_;
+	int width_;  // size of the first frame, 0 before it
+	int height_;
+};
+
+//! Raw rgb24 video: width x height frames of interleaved 8-bit RGB one after another, with no header
+/**
+ * Reads the clips KrabsClipRecorder saves, or what e.g. ffmpeg -f rawvideo -pix_fmt rgb24 writes to a file or a pipe.
+ */
+class KrabsRawVideo : public KrabsFrameSource
+{
+public:
+	//! Reads filename, or the standard input for "-", throwing CImgArgumentException unless width and height are positive
+	KrabsRawVideo(const char* filename, const int width, const int height);
+	~KrabsRawVideo();
+
+	KrabsRawVideo(const KrabsRawVideo&) = delete;
+	KrabsRawVideo& operator=(const KrabsRawVideo&) = delete;
+
+	bool Grab(cimg_library::CImg<double>& frame, const unsigned int skip_frames = 0);
+	bool GrabGray(cimg_library::CImg<unsigned char>& gray, const unsigned int skip_frames = 0);
+	void Release();
+	bool is_live() const { return false; }
+
+private:
+	//! Reads the next frame into buffer_, after dropping skip_frames
+	bool Read(const unsigned int skip_frames);
+
+	std::FILE* file_;
+	bool owns_file_;
+	cimg_library::CImg<unsigned char> buffer_; // one interleaved frame, as 3 x width x height
+};
+
+//! Generated frames of shapes moving over a textured background, the same for the same seed
+/**
+ * The background is smooth noise. Rectangles and ellipses of random size and color move at constant speed and
+ * bounce off the frame borders, and every frame gets a layer of sensor-like noise. All randomness comes from the
+ * seed, so a seed always produces the same frames, on any machine and whatever the timing of the reader.
+ */
+class KrabsSyntheticSource : public KrabsFrameSource
+{
+public:
+	//! Generates frames frames, or never ends for 0
+	KrabsSyntheticSource(const int width, const int height, const unsigned long frames, const unsigned int seed, const int shapes = 4);
+
+	bool Grab(cimg_library::CImg<double>& frame, const unsigned int skip_frames = 0);
+	void Release() { ended_ = true; }
+	bool is_live() const { return false; }
+
+private:
+	struct Shape
+	{
+		double x, y;   // center
+		double vx, vy; // pixels per frame
+		int half_width, half_height;
+		double color[3];
+		bool ellipse;
+	};
+
+	void Move();
+
+	cimg_library::CImg<double> background_;
+	std::vector<double> noise_;
+	std::vector<Shape> shapes_;
+	std::mt19937 random_;
+	unsigned long frames_;
+	unsigned long frame_;
+	bool ended_;
+};
+
+//! Opens the frame source a name stands for
+/**
+ * - digits: camera index, asking for width x height frames
+ * - synthetic[:frames[:seed]]: KrabsSyntheticSource of width x height frames, 300 frames with seed 1 by default,
+ *   0 frames for no end
+ * - a directory: KrabsImageSequence
+ * - "-", or a file ending in .rgb: KrabsRawVideo, of the size in a name ending in _<width>x<height>.rgb as
+ *   KrabsClipRecorder writes them, of width x height otherwise
+ * - any other file: video file read by OpenCV
+ *
+ * Throws CImgIOException when the source cannot be opened.
+ */
+std::unique_ptr<KrabsFrameSource> KrabsOpenFrameSource(const char* name, const int width, const int height);
+
+#endif // CIMGTEST_LIB_KRABS_SOURCE_H_
@@ -0,0 +1,209 @@
+#include "krabs_tracker.h"
+#include "krabs_regions.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+// variances in pixels^2, per frame for the process noise
+const float kMeasurementNoise = 4.0f;
+const float kProcessNoise = 1.0f;
+const float kVelocityNoise = 100.0f; // initial velocity uncertainty, up to about 10 pixels per frame
+
+void KrabsAxisFilter::Reset(const float measured, const float measurement_noise, const float velocity_noise)
+{
+	position = measured;
+	velocity = 0;
+	p00 = measurement_noise;
+	p01 = 0;
+	p11 = velocity_noise;
+}
+
+void KrabsAxisFilter::Predict(const float process_noise)
+{
+	// x = F x, P = F P F' + Q with F = [1 1; 0 1] and Q = diag(q, q)
+
+	position += velocity;
+	p00 += 2*p01 + p11 + process_noise;
+	p01 += p11;
+	p11 += process_noise;
+}
+
+void KrabsAxisFilter::Correct(const float measured, const float measurement_noise)
+{
+	// H = [1 0]: K = P H' / (H P H' + R), x += K (z - H x), P = (I - K H) P
+
+	const float kInnovation = measured - position;
+	const float kGain0 = p00/(p00 + measurement_noise);
+	const float kGain1 = p01/(p00 + measurement_noise);
+
+	position += kGain0*kInnovation;
+	velocity += kGain1*kInnovation;
+	p11 -= kGain1*p01;
+	p01 -= kGain0*p01;
+	p00 -= kGain0*p00;
+}
+
+KrabsRegionTracker::KrabsRegionTracker(const double iou_threshold, const unsigned int max_misses, const bool predict) :
+	iou_threshold_(iou_threshold), max_misses_(max_misses), predict_(predict), next_id_(1)
+{
+}
+
+void KrabsRegionTracker::Predict(KrabsTrack &track) const
+{
+	if (!predict_)
+	{
+		track.predicted = track.region;
+		return;
+	}
+
+	track.center_x.Predict(kProcessNoise);
+	track.center_y.Predict(kProcessNoise);
+
+	const int kWidth = track.region.x1 - track.region.x0;
+	const int kHeight = track.region.y1 - track.region.y0;
+
+	track.predicted = track.region;
+	track.predicted.x0 = (int)lround(track.center_x.position - 0.5f*kWidth);
+	track.predicted.y0 = (int)lround(track.center_y.position - 0.5f*kHeight);
+	track.predicted.x1 = track.predicted.x0 + kWidth;
+	track.predicted.y1 = track.predicted.y0 + kHeight;
+}
+
+void KrabsRegionTracker::Correct(KrabsTrack &track, const KrabsRegion &region) const
+{
+	const float kCenterX = 0.5f*(region.x0 + region.x1);
+	const float kCenterY = 0.5f*(region.y0 + region.y1);
+
+	if (track.hits == 0)
+	{
+		track.center_x.Reset(kCenterX, kMeasurementNoise, kVelocityNoise);
+		track.center_y.Reset(kCenterY, kMeasurementNoise, kVelocityNoise);
+	}
+	else
+	{
+		track.center_x.Correct(kCenterX, kMeasurementNoise);
+		track.center_y.Correct(kCenterY, kMeasurementNoise);
+	}
+
+	track.region = region;
+	track.hits++;
+	track.misses = 0;
+}
+
+void KrabsRegionTracker::Score(const vector<KrabsRegion> &regions, const int max_size, const bool by_distance)
+{
+	// tracks overlapping a region along x, or close to it for the distance pass, form a range of order_
+
+	const int kMargin = by_distance ? max_size : 0;
+
+	matches_.clear();
+	for (size_t i = 0; i < regions.size(); i++)
+	{
+		if (region_track_[i] >= 0)
+			continue;
+
+		const KrabsRegion &kRegion = regions[i];
+
+		vector<pair<int,int>>::const_iterator sorted = lower_bound(order_.begin(), order_.end(), make_pair(kRegion.x0 - max_size - kMargin, -1));
+
+		for (; sorted != order_.end() && sorted->first <= kRegion.x1 + kMargin; ++sorted)
+		{
+			const int kTrack = sorted->second;
+			if (track_matched_[kTrack])
+				continue;
+
+			const KrabsRegion &kPredicted = tracks_[kTrack].predicted;
+
+			if (by_distance)
+			{
+				const double kDx = 0.5*(kPredicted.x0 + kPredicted.x1 - kRegion.x0 - kRegion.x1);
+				const double kDy = 0.5*(kPredicted.y0 + kPredicted.y1 - kRegion.y0 - kRegion.y1);
+				const double kGate = max(kPredicted.x1 - kPredicted.x0, kPredicted.y1 - kPredicted.y0) + 1;
+
+				if (kDx*kDx + kDy*kDy <= kGate*kGate)
+					matches_.push_back({-(kDx*kDx + kDy*kDy), kTrack, (int)i});
+			}
+			else
+			{
+				const double kIoU = KrabsIoU(kPredicted, kRegion);
+				if (kIoU > iou_threshold_)
+					matches_.push_back({kIoU, kTrack, (int)i});
+			}
+		}
+	}
+}
+
+void KrabsRegionTracker::Assign()
+{
+	// greedy by decreasing score, ties broken by index so the result does not depend on the sort
+
+	sort(matches_.begin(), matches_.end(), [](const Match &a, const Match &b) {
+		if (a.score != b.score)
+			return a.score > b.score;
+		return a.track != b.track ? a.track < b.track : a.region < b.region;
+	});
+
+	for (const Match &kMatch : matches_)
+		if (!track_matched_[kMatch.track] && region_track_[kMatch.region] < 0)
+		{
+			track_matched_[kMatch.track] = true;
+			region_track_[kMatch.region] = kMatch.track;
+		}
+}
+
+void KrabsRegionTracker::Update(vector<KrabsRegion> &regions)
+{
+	int max_size = 0;
+	order_.resize(tracks_.size());
+	for (size_t i = 0; i < tracks_.size(); i++)
+	{
+		Predict(tracks_[i]);
+		const KrabsRegion &kPredicted = tracks_[i].predicted;
+		max_size = max(max_size, max(kPredicted.x1 - kPredicted.x0, kPredicted.y1 - kPredicted.y0) + 1);
+		order_[i] = make_pair(kPredicted.x0, (int)i);
+	}
+
+	sort(order_.begin(), order_.end());
+
+	region_track_.assign(regions.size(), -1);
+	track_matched_.assign(tracks_.size(), false);
+
+	Score(regions, max_size, false);
+	Assign();
+
+	// the leftovers are paired by distance, which catches an object moving farther than its size before its velocity is known
+
+	Score(regions, max_size, true);
+	Assign();
+
+	for (size_t i = 0; i < regions.size(); i++)
+	{
+		if (region_track_[i] < 0)
+		{
+			region_track_[i] = (int)tracks_.size();
+			track_matched_.push_back(true);
+			tracks_.push_back(KrabsTrack());
+			tracks_.back().id = next_id_++;
+		}
+
+		KrabsTrack &track = tracks_[region_track_[i]];
+		Correct(track, regions[i]);
+		regions[i].track = track.id;
+	}
+
+	// drop the tracks missed for too long, keeping the others in order
+
+	size_t kept = 0;
+	for (size_t i = 0; i < tracks_.size(); i++)
+	{
+		if (!track_matched_[i] && ++tracks_[i].misses > max_misses_)
+			continue;
+
+		if (kept != i)
+			tracks_[kept] = tracks_[i];
+		kept++;
+	}
+	tracks_.resize(kept);
+}
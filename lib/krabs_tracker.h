@@ -0,0 +1,101 @@
+#ifndef CIMGTEST_LIB_KRABS_TRACKER_H_
+#define CIMGTEST_LIB_KRABS_TRACKER_H_
+
+#include "krabs.h"
+#include <utility>
+#include <vector>
+
+//! Constant velocity Kalman filter along one axis, position in pixels and velocity in pixels per frame
+/**
+ * The covariance is kept as its three distinct terms, p00 for the position, p11 for the velocity and p01 between them.
+ *
+ * Source: https://en.wikipedia.org/wiki/Kalman_filter#Example_application,_technical
+ */
+struct KrabsAxisFilter
+{
+	float position = 0;
+	float velocity = 0;
+	float p00 = 0;
+	float p01 = 0;
+	float p11 = 0;
+
+	//! Starts at position with an unknown velocity
+	void Reset(const float measured, const float measurement_noise, const float velocity_noise);
+
+	//! Moves one frame ahead
+	void Predict(const float process_noise);
+
+	//! Blends a measured position into the state
+	void Correct(const float measured, const float measurement_noise);
+};
+
+//! Region followed across frames under a persistent id
+struct KrabsTrack
+{
+	unsigned int id = 0;
+	KrabsRegion region;     // last matched region
+	KrabsRegion predicted;  // box expected on the next frame, matched against the new regions
+	unsigned int hits = 0;   // frames matched since the track started
+	unsigned int misses = 0; // consecutive frames without a match
+	KrabsAxisFilter center_x;
+	KrabsAxisFilter center_y;
+};
+
+//! Gives regions found on consecutive frames a persistent id
+/**
+ * Each frame, the regions are matched to the boxes predicted for the tracks, by decreasing IoU: the pair with the
+ * highest IoU is matched first, then the highest pair left whose track and region are both free, and so on.
+ * The tracks and regions left are then matched the same way by the distance between their centers, up to the track
+ * box size. Matched regions take the id of their track, the other regions start new tracks, and tracks missing for
+ * more than max_misses frames are dropped.
+ *
+ * With predict, the box centers follow a constant velocity Kalman filter, so a moving object keeps overlapping its
+ * predicted box once its velocity is known. Otherwise the last box is matched as is.
+ *
+ * Only pairs whose boxes overlap or nearly overlap along x are scored, found by a binary search over the tracks
+ * sorted by x0, so sparse scenes with hundreds of regions cost far less than every pair.
+ *
+ * Source: https://arxiv.org/abs/1602.00763
+ */
+class KrabsRegionTracker
+{
+public:
+	KrabsRegionTracker(const double iou_threshold = 0.3, const unsigned int max_misses = 5, const bool predict = true);
+
+	//! Matches regions to the tracks and sets their track id
+	void Update(std::vector<KrabsRegion> &regions);
+
+	//! Tracks alive after the last update, including the ones missed on it
+	const std::vector<KrabsTrack>& tracks() const { return tracks_; }
+
+private:
+	struct Match
+	{
+		double score; // IoU, or minus the squared center distance
+		int track;
+		int region;
+	};
+
+	void Predict(KrabsTrack &track) const;
+	void Correct(KrabsTrack &track, const KrabsRegion &region) const;
+
+	//! Fills matches_ with the pairs of unmatched tracks and regions, scored by IoU or by center distance
+	void Score(const std::vector<KrabsRegion> &regions, const int max_size, const bool by_distance);
+
+	//! Matches the pairs of matches_ by decreasing score
+	void Assign();
+
+	const double iou_threshold_;
+	const unsigned int max_misses_;
+	const bool predict_;
+	unsigned int next_id_;
+	std::vector<KrabsTrack> tracks_;
+
+	// reused between updates
+	std::vector<std::pair<int,int>> order_; // predicted x0 and track index, sorted
+	std::vector<Match> matches_;
+	std::vector<int> region_track_;
+	std::vector<bool> track_matched_;
+};
+
+#endif // CIMGTEST_LIB_KRABS_TRACKER_H_